@@ -0,0 +1,162 @@
+#define _GNU_SOURCE             /* sched_setaffinity, CPU_* */
+#include <errno.h>
+#include <math.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/utsname.h>
+#include <time.h>
+#include <unistd.h>
+#include "bench.h"
+
+static int allowed[CPU_SETSIZE];    /* CPUs we may run on, in order */
+static int n_allowed;
+static int home;                    /* index in allowed of the harness CPU */
+
+static int
+pin_to(int cpu)
+{
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) == -1)
+        return -1;
+    return cpu;
+}
+
+int
+bench_init(int cpu)
+{
+    cpu_set_t set;
+
+    if (sched_getaffinity(0, sizeof(set), &set) == -1)
+        return -1;
+    n_allowed = 0;
+    home = 0;
+    for (int i = 0; i < CPU_SETSIZE; i++) {
+        if (CPU_ISSET(i, &set)) {
+            if (i == cpu)
+                home = n_allowed;
+            allowed[n_allowed++] = i;
+        }
+    }
+    if (n_allowed == 0 || (cpu >= 0 && allowed[home] != cpu)) {
+        errno = EINVAL;
+        return -1;
+    }
+    return pin_to(allowed[home]);
+}
+
+int
+bench_pin(int n)
+{
+    return pin_to(allowed[(home + n) % n_allowed]);
+}
+
+double
+bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+int
+bench_run(const struct bench *b, const struct bench_config *cfg,
+          struct bench_result *out)
+{
+    uint64_t want = b->ops * cfg->scale;
+    void *state = NULL;
+    double *samples, sum = 0, sq = 0;
+    int rc = 0;
+
+    if (want == 0)
+        want = 1;
+    samples = malloc(cfg->trials * sizeof(*samples));
+    if (samples == NULL)
+        return -1;
+    if (b->setup != NULL && b->setup(&state) == -1) {
+        free(samples);
+        return -1;
+    }
+
+    memset(out, 0, sizeof(*out));
+    for (int i = -cfg->warmup; i < cfg->trials; i++) {
+        uint64_t ops = want;
+        double secs = b->run(state, &ops);
+
+        if (secs < 0 || ops == 0) {
+            rc = -1;
+            break;
+        }
+        if (i >= 0) {
+            samples[i] = secs * 1e9 / ops;
+            out->ops = ops;
+        }
+    }
+
+    if (b->teardown != NULL)
+        b->teardown(state);
+    if (rc == 0) {
+        qsort(samples, cfg->trials, sizeof(*samples), compare_doubles);
+        for (int i = 0; i < cfg->trials; i++)
+            sum += samples[i];
+        out->mean = sum / cfg->trials;
+        for (int i = 0; i < cfg->trials; i++)
+            sq += (samples[i] - out->mean) * (samples[i] - out->mean);
+        out->name = b->name;
+        out->unit = b->unit;
+        out->trials = cfg->trials;
+        out->min = samples[0];
+        out->median = cfg->trials % 2 ? samples[cfg->trials / 2] :
+            (samples[cfg->trials / 2 - 1] + samples[cfg->trials / 2]) / 2;
+        out->stddev = cfg->trials > 1 ? sqrt(sq / (cfg->trials - 1)) : 0;
+    }
+    free(samples);
+    return rc;
+}
+
+void
+bench_write_json(FILE *f, const struct bench_config *cfg,
+                 const struct bench_result *results, size_t n)
+{
+    struct utsname un;
+
+    if (uname(&un) == -1)
+        strcpy(un.nodename, "unknown");
+
+    /* One benchmark per line keeps diffs of stored baselines readable
+        and lets bench_compare find fields without a full JSON parser. */
+
+    fprintf(f, "{\n");
+    fprintf(f, "  \"schema\": 1,\n");
+    fprintf(f, "  \"timestamp\": %ld,\n", (long) time(NULL));
+    fprintf(f, "  \"host\": \"%s\",\n", un.nodename);
+    fprintf(f, "  \"cpus\": %d,\n", n_allowed);
+    fprintf(f, "  \"cpu\": %d,\n", cfg->cpu);
+    fprintf(f, "  \"warmup\": %d,\n", cfg->warmup);
+    fprintf(f, "  \"trials\": %d,\n", cfg->trials);
+    fprintf(f, "  \"scale\": %g,\n", cfg->scale);
+    fprintf(f, "  \"benchmarks\": [\n");
+    for (size_t i = 0; i < n; i++) {
+        const struct bench_result *r = &results[i];
+
+        fprintf(f, "    {\"name\": \"%s\", \"unit\": \"%s\", \"ops\": %llu, "
+                "\"trials\": %d, \"min\": %.3f, \"median\": %.3f, "
+                "\"mean\": %.3f, \"stddev\": %.3f}%s\n",
+                r->name, r->unit, (unsigned long long) r->ops, r->trials,
+                r->min, r->median, r->mean, r->stddev,
+                i + 1 < n ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+}
@@ -0,0 +1,72 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Microbenchmark harness shared by every component's benchmarks.
+
+    Each benchmark is run a fixed number of warm-up trials (discarded:
+    they fault in memory, fill caches and let the CPU clock settle),
+    then a fixed number of measured trials. A trial performs 'ops'
+    operations and reports how long the measured part took; results
+    are kept as nanoseconds per operation so numbers from different
+    scales and machines line up. The calling thread is pinned to one
+    CPU for the whole run, and multi-threaded benchmarks pin their
+    threads with bench_pin(), so the scheduler cannot move work around
+    between trials. */
+
+struct bench {
+    const char *name;           /* "component.what", unique in the suite */
+    const char *unit;           /* what one operation is */
+    uint64_t ops;               /* operations per trial, before scaling */
+
+    /* Optional: build per-benchmark state once, before warm-up.
+        Returns 0, or -1 to skip the benchmark. */
+    int (*setup)(void **state);
+
+    /* Run one trial of *ops operations. May do fewer (or more) and
+        report the actual count back through *ops. Returns the seconds
+        spent in the measured part, or a negative value on failure. */
+    double (*run)(void *state, uint64_t *ops);
+
+    void (*teardown)(void *state);
+};
+
+struct bench_config {
+    int warmup;                 /* discarded trials */
+    int trials;                 /* measured trials */
+    double scale;               /* multiplies every benchmark's ops */
+    int cpu;                    /* CPU the harness runs on */
+};
+
+struct bench_result {
+    const char *name;
+    const char *unit;
+    uint64_t ops;               /* per trial, as last reported by run() */
+    int trials;
+    double min, median, mean, stddev;   /* ns per op */
+};
+
+/* Record the CPUs this process may run on and pin the calling thread
+    to cpu (-1 for the first allowed one). Returns the CPU pinned to,
+    or -1 with errno set. */
+int bench_init(int cpu);
+
+/* Pin the calling thread to the n-th allowed CPU after the harness's
+    own, wrapping around when there are fewer CPUs than threads.
+    Returns the CPU, or -1 with errno set. */
+int bench_pin(int n);
+
+/* CLOCK_MONOTONIC in seconds. */
+double bench_now(void);
+
+/* Run b as configured by cfg. Returns 0, or -1 if setup or a trial
+    failed (out is then left unfilled). */
+int bench_run(const struct bench *b, const struct bench_config *cfg,
+              struct bench_result *out);
+
+void bench_write_json(FILE *f, const struct bench_config *cfg,
+                      const struct bench_result *results, size_t n);
+
+#endif
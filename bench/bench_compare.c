@@ -0,0 +1,162 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Compare two result files written by bench and flag regressions.
+
+    Every number is nanoseconds per operation, so higher is worse. A
+    benchmark regressed when its median grew by more than the threshold
+    AND even its fastest trial is slower than the baseline median; the
+    second condition keeps one noisy trial from failing a run. A
+    baseline benchmark with no current result is reported as missing,
+    unless -f shows it was left out on purpose. Exits 1 if anything
+    regressed or went missing, so it can gate a build. */
+
+#define DEFAULT_THRESHOLD 5.0   /* percent */
+
+struct entry {
+    char name[128];
+    double median, min;
+};
+
+/* Value of "key": following p (and before end), or NAN. */
+
+static double
+number_after(const char *p, const char *end, const char *key)
+{
+    char pattern[64];
+    const char *q;
+
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+    q = strstr(p, pattern);
+    if (q == NULL || (end != NULL && q > end))
+        return NAN;
+    return strtod(q + strlen(pattern), NULL);
+}
+
+/* Load the "benchmarks" array of a result file. Returns the number of
+    entries (at most max), or -1 if the file cannot be read. */
+
+static int
+load(const char *path, struct entry *entries, int max)
+{
+    char *text = NULL, *p, *next;
+    size_t cap = 0;
+    int n = 0;
+    FILE *f = fopen(path, "r");
+
+    if (f == NULL || getdelim(&text, &cap, '\0', f) == -1) {
+        if (f != NULL)
+            fclose(f);
+        free(text);
+        return -1;
+    }
+    fclose(f);
+
+    for (p = strstr(text, "\"name\":"); p != NULL && n < max; p = next) {
+        struct entry *e = &entries[n];
+        const char *q = strchr(p + 7, '"');
+        const char *close = q ? strchr(q + 1, '"') : NULL;
+
+        next = strstr(p + 7, "\"name\":");
+        if (close == NULL || close - q - 1 >= (long) sizeof(e->name))
+            continue;
+        memcpy(e->name, q + 1, close - q - 1);
+        e->name[close - q - 1] = '\0';
+        e->median = number_after(close, next, "median");
+        e->min = number_after(close, next, "min");
+        if (!isnan(e->median) && !isnan(e->min))
+            n++;
+    }
+    free(text);
+    return n;
+}
+
+int
+main(int argc, char* argv[])
+{
+    static struct entry base[256], cur[256];
+    const char *filter = NULL;
+    double threshold = DEFAULT_THRESHOLD;
+    int opt, n_base, n_cur, regressions = 0, missing = 0;
+
+    while ((opt = getopt(argc, argv, "f:t:")) != -1) {
+        switch (opt) {
+        case 'f':
+            filter = optarg;
+            break;
+        case 't':
+            threshold = atof(optarg);
+            break;
+        default:
+            optind = argc + 1;      /* force the usage message */
+            break;
+        }
+    }
+
+    if (optind != argc - 2) {
+        printf("Usage: %s [-f FILTER] [-t PERCENT] BASELINE CURRENT\n", argv[0]);
+        printf("  -f  the current run used bench -f FILTER; baseline benchmarks"
+               " it excludes are not missing\n");
+        printf("  -t  slowdown of the median that counts as a regression"
+               " (default %.0f%%)\n", DEFAULT_THRESHOLD);
+        exit(2);
+    }
+
+    n_base = load(argv[optind], base, 256);
+    n_cur = load(argv[optind + 1], cur, 256);
+    if (n_base == -1 || n_cur == -1) {
+        fprintf(stderr, "Cannot read '%s'\n", argv[n_base == -1 ? optind : optind + 1]);
+        exit(2);
+    }
+
+    printf("%-28s %12s %12s %8s\n", "benchmark", "baseline ns", "current ns", "change");
+    for (int i = 0; i < n_cur; i++) {
+        const struct entry *b = NULL;
+        double change;
+
+        for (int j = 0; j < n_base && b == NULL; j++) {
+            if (strcmp(base[j].name, cur[i].name) == 0)
+                b = &base[j];
+        }
+        if (b == NULL) {
+            printf("%-28s %12s %12.1f %8s  new\n", cur[i].name, "-", cur[i].median, "");
+            continue;
+        }
+        change = (cur[i].median - b->median) / b->median * 100;
+        printf("%-28s %12.1f %12.1f %+7.1f%%", cur[i].name, b->median, cur[i].median,
+               change);
+        if (change > threshold && cur[i].min > b->median) {
+            printf("  REGRESSION");
+            regressions++;
+        } else if (change < -threshold && cur[i].median < b->min) {
+            printf("  improved");
+        }
+        putchar('\n');
+    }
+
+    /* A benchmark that failed or was dropped from the suite leaves no
+        result at all, which must not read as a clean run. */
+
+    for (int j = 0; j < n_base; j++) {
+        int found = 0;
+
+        if (filter != NULL && strstr(base[j].name, filter) == NULL)
+            continue;
+        for (int i = 0; i < n_cur && !found; i++)
+            found = strcmp(base[j].name, cur[i].name) == 0;
+        if (!found) {
+            printf("%-28s %12.1f %12s %8s  MISSING\n", base[j].name, base[j].median,
+                   "-", "");
+            missing++;
+        }
+    }
+
+    if (regressions)
+        printf("%d regression(s) over %.1f%%\n", regressions, threshold);
+    if (missing)
+        printf("%d benchmark(s) missing from '%s'\n", missing, argv[optind + 1]);
+    exit(regressions || missing ? 1 : 0);
+}
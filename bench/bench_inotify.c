@@ -0,0 +1,137 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include "coalesce.h"
+#include "suites.h"
+
+#define INOTIFY_FILES 64
+#define INOTIFY_READ_BUF (256 * 1024)   /* the watcher's default */
+
+/* Event ingestion: the part of the watcher's loop that drains the
+    kernel queue and feeds events into the coalescer, then flushes the
+    merged records. Each trial first generates open/close events on a
+    watched directory (not timed), then times draining them. Events are
+    generated in batches that stay below the default
+    fs.inotify.max_queued_events (16384), so no events are lost to an
+    overflow; a trial of more operations runs several batches. */
+
+#define INOTIFY_BATCH_EVENTS 16000
+
+struct inotify_state {
+    char dir[64];
+    int fd;
+    char *buf;
+    struct coalescer coalescer;
+};
+
+static int
+setup_inotify(void **state)
+{
+    struct inotify_state *st = calloc(1, sizeof(*st));
+    char path[PATH_MAX];
+
+    if (st == NULL)
+        return -1;
+    strcpy(st->dir, "/tmp/bench-inotify-XXXXXX");
+    st->buf = aligned_alloc(__alignof__(struct inotify_event), INOTIFY_READ_BUF);
+    if (st->buf == NULL || mkdtemp(st->dir) == NULL)
+        goto fail;
+    for (int i = 0; i < INOTIFY_FILES; i++) {
+        int fd;
+
+        snprintf(path, sizeof(path), "%s/file%d", st->dir, i);
+        if ((fd = open(path, O_CREAT | O_WRONLY, 0644)) == -1)
+            goto fail;
+        close(fd);
+    }
+    st->fd = inotify_init1(IN_NONBLOCK);
+    if (st->fd == -1 || inotify_add_watch(st->fd, st->dir, IN_OPEN | IN_CLOSE) == -1 ||
+            coalescer_init(&st->coalescer, 100) == -1)
+        goto fail;
+    *state = st;
+    return 0;
+
+fail:
+    free(st->buf);
+    free(st);
+    return -1;
+}
+
+static void
+count_record(const struct change_record *rec, void *arg)
+{
+    (*(uint64_t *) arg)++;
+}
+
+static double
+run_inotify(void *state, uint64_t *ops)
+{
+    struct inotify_state *st = state;
+    uint64_t pairs = *ops / 2, events = 0, records = 0;
+    const struct inotify_event *event;
+    char path[PATH_MAX];
+    double elapsed = 0, start;
+    ssize_t len;
+
+    for (uint64_t done = 0; done < pairs; ) {
+        uint64_t batch = pairs - done < INOTIFY_BATCH_EVENTS / 2 ?
+                         pairs - done : INOTIFY_BATCH_EVENTS / 2;
+
+        for (uint64_t i = done; i < done + batch; i++) {
+            int fd;
+
+            snprintf(path, sizeof(path), "%s/file%llu", st->dir,
+                     (unsigned long long) (i % INOTIFY_FILES));
+            if ((fd = open(path, O_RDONLY)) == -1)
+                return -1;
+            close(fd);
+        }
+        done += batch;
+
+        start = bench_now();
+        while ((len = read(st->fd, st->buf, INOTIFY_READ_BUF)) > 0) {
+            long now = (long) (bench_now() * 1000);
+
+            for (char *ptr = st->buf; ptr < st->buf + len;
+                    ptr += sizeof(struct inotify_event) + event->len) {
+                event = (const struct inotify_event *) ptr;
+                if (event->mask & IN_Q_OVERFLOW)
+                    return -1;
+                coalescer_add(&st->coalescer, st->dir, event->len ? event->name : NULL,
+                              event->mask, now);
+                events++;
+            }
+        }
+        if (done == pairs)
+            coalescer_flush(&st->coalescer, count_record, &records);
+        elapsed += bench_now() - start;
+    }
+    *ops = events;
+    return elapsed;
+}
+
+static void
+teardown_inotify(void *state)
+{
+    struct inotify_state *st = state;
+    char path[PATH_MAX];
+
+    close(st->fd);
+    coalescer_free(&st->coalescer);
+    for (int i = 0; i < INOTIFY_FILES; i++) {
+        snprintf(path, sizeof(path), "%s/file%d", st->dir, i);
+        unlink(path);
+    }
+    rmdir(st->dir);
+    free(st->buf);
+    free(st);
+}
+
+const struct bench inotify_benchmarks[] = {
+    { "inotify.ingest", "event", INOTIFY_BATCH_EVENTS, setup_inotify, run_inotify, teardown_inotify },
+};
+const size_t n_inotify_benchmarks = sizeof(inotify_benchmarks) / sizeof(inotify_benchmarks[0]);
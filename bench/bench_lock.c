@@ -0,0 +1,155 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include "reader.h"
+#include "writer.h"
+#include "suites.h"
+
+/* The reader/writer protocol of problem_set_1/p1 keeps its state in
+    globals that main.c normally defines; the benchmark provides them. */
+
+int resource_counter = 0;
+int reader_queue = 0;
+pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t read_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t write_cond = PTHREAD_COND_INITIALIZER;
+pthread_cond_t *read_phase = &read_cond;
+pthread_cond_t *write_phase = &write_cond;
+char X = 'X';
+
+#define MIXED_READERS 4
+#define MIXED_WRITERS 1
+
+static double
+run_read_uncontended(void *state, uint64_t *ops)
+{
+    double start = bench_now();
+
+    for (uint64_t i = 0; i < *ops; i++) {
+        reader_enter();
+        reader_exit();
+    }
+    return bench_now() - start;
+}
+
+static double
+run_write_uncontended(void *state, uint64_t *ops)
+{
+    double start = bench_now();
+
+    for (uint64_t i = 0; i < *ops; i++) {
+        writer_enter();
+        writer_exit();
+    }
+    return bench_now() - start;
+}
+
+/* Start line for the mixed threads: like a barrier, except that main
+    can call the run off (go = -1) when it could not start every
+    thread, and the ones already waiting return without running. */
+
+struct mixed_start {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int ready;                  /* threads waiting at the line */
+    int go;                     /* 0 wait, 1 run, -1 abandon */
+};
+
+struct mixed_thread {
+    pthread_t thread;
+    int n;                      /* which thread, for bench_pin() */
+    int writer;
+    uint64_t ops;
+    struct mixed_start *start;
+    double begin, end;          /* this thread's own timed section */
+};
+
+static void *
+mixed_worker(void *arg)
+{
+    struct mixed_thread *t = arg;
+    int go;
+
+    bench_pin(t->n);
+    pthread_mutex_lock(&t->start->lock);
+    t->start->ready++;
+    pthread_cond_broadcast(&t->start->cond);
+    while (t->start->go == 0)
+        pthread_cond_wait(&t->start->cond, &t->start->lock);
+    go = t->start->go;
+    pthread_mutex_unlock(&t->start->lock);
+    if (go < 0)
+        return NULL;
+
+    t->begin = bench_now();
+    for (uint64_t i = 0; i < t->ops; i++) {
+        if (t->writer) {
+            writer_enter();
+            writer_exit();
+        } else {
+            reader_enter();
+            reader_exit();
+        }
+    }
+    t->end = bench_now();
+    return NULL;
+}
+
+/* Readers and writers hammering the lock at once, each thread on its
+    own CPU where there are enough. Reports wall time per acquisition
+    across all threads, from the first thread starting to the last one
+    finishing; each thread times itself, since the released threads may
+    be done before main gets to look at the clock. */
+
+static double
+run_mixed(void *state, uint64_t *ops)
+{
+    struct mixed_thread threads[MIXED_READERS + MIXED_WRITERS];
+    int n = MIXED_READERS + MIXED_WRITERS;
+    struct mixed_start start = {
+        PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0
+    };
+    int started = 0;
+    double begin, end;
+
+    for (; started < n; started++) {
+        struct mixed_thread *t = &threads[started];
+
+        t->n = started + 1;
+        t->writer = started >= MIXED_READERS;
+        t->ops = *ops / n;
+        t->start = &start;
+        if (pthread_create(&t->thread, NULL, mixed_worker, t) != 0)
+            break;
+    }
+
+    pthread_mutex_lock(&start.lock);
+    while (start.ready < started)
+        pthread_cond_wait(&start.cond, &start.lock);
+    start.go = started == n ? 1 : -1;
+    pthread_cond_broadcast(&start.cond);
+    pthread_mutex_unlock(&start.lock);
+
+    for (int i = 0; i < started; i++)
+        pthread_join(threads[i].thread, NULL);
+    pthread_cond_destroy(&start.cond);
+    pthread_mutex_destroy(&start.lock);
+    if (started < n)
+        return -1;              /* fail this benchmark, not the suite */
+    begin = threads[0].begin;
+    end = threads[0].end;
+    for (int i = 1; i < n; i++) {
+        if (threads[i].begin < begin)
+            begin = threads[i].begin;
+        if (threads[i].end > end)
+            end = threads[i].end;
+    }
+    *ops = *ops / n * n;
+    return end - begin;
+}
+
+const struct bench lock_benchmarks[] = {
+    { "lock.read_uncontended", "enter+exit", 2000000, NULL, run_read_uncontended, NULL },
+    { "lock.write_uncontended", "enter+exit", 2000000, NULL, run_write_uncontended, NULL },
+    { "lock.mixed_4r1w", "enter+exit", 500000, NULL, run_mixed, NULL },
+};
+const size_t n_lock_benchmarks = sizeof(lock_benchmarks) / sizeof(lock_benchmarks[0]);
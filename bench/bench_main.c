@@ -0,0 +1,107 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "bench.h"
+#include "suites.h"
+
+#define DEFAULT_WARMUP 2
+#define DEFAULT_TRIALS 10
+
+static const struct {
+    const struct bench *benches;
+    const size_t *n;
+} suites[] = {
+    { lock_benchmarks, &n_lock_benchmarks },
+    { echo_benchmarks, &n_echo_benchmarks },
+    { resolver_benchmarks, &n_resolver_benchmarks },
+    { inotify_benchmarks, &n_inotify_benchmarks },
+    { trace_benchmarks, &n_trace_benchmarks },
+};
+
+int
+main(int argc, char* argv[])
+{
+    struct bench_config cfg = { DEFAULT_WARMUP, DEFAULT_TRIALS, 1.0, -1 };
+    struct bench_result results[64];
+    const char *output = NULL, *filter = NULL;
+    size_t n_results = 0;
+    int opt, failed = 0;
+    FILE *out = stdout;
+
+    while ((opt = getopt(argc, argv, "c:f:n:o:s:w:")) != -1) {
+        switch (opt) {
+        case 'c':
+            cfg.cpu = atoi(optarg);
+            break;
+        case 'f':
+            filter = optarg;
+            break;
+        case 'n':
+            cfg.trials = atoi(optarg);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 's':
+            cfg.scale = atof(optarg);
+            break;
+        case 'w':
+            cfg.warmup = atoi(optarg);
+            break;
+        default:
+            optind = argc + 1;      /* force the usage message */
+            break;
+        }
+    }
+
+    if (optind != argc || cfg.trials < 1 || cfg.warmup < 0 || cfg.scale <= 0) {
+        printf("Usage: %s [-c CPU] [-f FILTER] [-n TRIALS] [-w WARMUP] [-s SCALE] [-o FILE]\n",
+               argv[0]);
+        printf("  -c  CPU to pin the harness to (default: first allowed)\n");
+        printf("  -f  only run benchmarks whose name contains FILTER\n");
+        printf("  -n  measured trials per benchmark (default %d)\n", DEFAULT_TRIALS);
+        printf("  -w  warm-up trials per benchmark (default %d)\n", DEFAULT_WARMUP);
+        printf("  -s  multiply every benchmark's operation count by SCALE\n");
+        printf("  -o  write JSON results to FILE (default: stdout)\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if ((cfg.cpu = bench_init(cfg.cpu)) == -1) {
+        fprintf(stderr, "Cannot pin to CPU: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    /* Progress and a readable table go to stderr; stdout may be JSON. */
+
+    fprintf(stderr, "%-28s %12s %12s %10s  %s\n", "benchmark", "median ns", "min ns",
+            "stddev", "per");
+    for (size_t s = 0; s < sizeof(suites) / sizeof(suites[0]); s++) {
+        for (size_t i = 0; i < *suites[s].n; i++) {
+            const struct bench *b = &suites[s].benches[i];
+            struct bench_result *r = &results[n_results];
+
+            if (filter != NULL && strstr(b->name, filter) == NULL)
+                continue;
+            if (n_results == sizeof(results) / sizeof(results[0]) ||
+                    bench_run(b, &cfg, r) == -1) {
+                fprintf(stderr, "%-28s FAILED\n", b->name);
+                failed++;
+                continue;
+            }
+            fprintf(stderr, "%-28s %12.1f %12.1f %10.1f  %s\n", r->name, r->median,
+                    r->min, r->stddev, r->unit);
+            n_results++;
+        }
+    }
+
+    if (output != NULL && (out = fopen(output, "w")) == NULL) {
+        fprintf(stderr, "Cannot write '%s': %s\n", output, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    bench_write_json(out, &cfg, results, n_results);
+    if (out != stdout)
+        fclose(out);
+    exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
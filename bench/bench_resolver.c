@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "suites.h"
+
+/* showip has no header; build its batch resolver in, without main. */
+
+#define SHOWIP_NO_MAIN
+#include "showip.c"
+
+#define RESOLVER_UNIQUE 2000        /* distinct names in the input */
+#define RESOLVER_WORKERS 8
+
+/* Batch throughput against a hosts-file fixture, so the numbers measure
+    the resolver pipeline (queue, TTL cache, workers, output) and not
+    the network. The input repeats each name, so most lines are cache
+    hits, like a real log of hostnames. */
+
+struct resolver_state {
+    char hosts_file[64];
+    char *input;
+    size_t input_len;
+    uint64_t lines;
+};
+
+static int
+setup_resolver(void **state)
+{
+    struct resolver_state *st = calloc(1, sizeof(*st));
+    FILE *f;
+    int fd;
+
+    if (st == NULL)
+        return -1;
+    strcpy(st->hosts_file, "/tmp/bench-hosts-XXXXXX");
+    fd = mkstemp(st->hosts_file);
+    if (fd == -1 || (f = fdopen(fd, "w")) == NULL) {
+        free(st);
+        return -1;
+    }
+    for (int i = 0; i < RESOLVER_UNIQUE; i++)
+        fprintf(f, "10.%d.%d.%d host%d.bench.test\n", i >> 16, (i >> 8) & 255,
+                i & 255, i);
+    fclose(f);
+    *state = st;
+    return 0;
+}
+
+static double
+run_resolver(void *state, uint64_t *ops)
+{
+    struct resolver_state *st = state;
+    batch_opts_t opts = { RESOLVER_WORKERS, DEFAULT_TTL_S, st->hosts_file };
+    batch_stats_t stats;
+    FILE *in, *out;
+    double start, elapsed;
+
+    /* Input is built once per size, outside the timed part. */
+
+    if (st->lines != *ops) {
+        FILE *mem;
+
+        free(st->input);
+        st->input = NULL;
+        mem = open_memstream(&st->input, &st->input_len);
+        if (mem == NULL)
+            return -1;
+        for (uint64_t i = 0; i < *ops; i++)
+            fprintf(mem, "host%llu.bench.test\n",
+                    (unsigned long long) (i * 7919 % RESOLVER_UNIQUE));
+        fclose(mem);
+        st->lines = *ops;
+    }
+
+    in = fmemopen(st->input, st->input_len, "r");
+    out = fopen("/dev/null", "w");
+    if (in == NULL || out == NULL)
+        return -1;
+    start = bench_now();
+    if (run_batch(in, out, &opts, &stats) != 0 || stats.failed != 0)
+        elapsed = -1;
+    else
+        elapsed = bench_now() - start;
+    fclose(in);
+    fclose(out);
+    *ops = stats.names;
+    return elapsed;
+}
+
+static void
+teardown_resolver(void *state)
+{
+    struct resolver_state *st = state;
+
+    unlink(st->hosts_file);
+    free(st->input);
+    free(st);
+}
+
+const struct bench resolver_benchmarks[] = {
+    { "resolver.batch_hosts", "name", 20000, setup_resolver, run_resolver, teardown_resolver },
+};
+const size_t n_resolver_benchmarks = sizeof(resolver_benchmarks) / sizeof(resolver_benchmarks[0]);
@@ -0,0 +1,21 @@
+#include "trace.h"
+#include "suites.h"
+
+/* Cost of one trace point when tracing is compiled in: what
+    TRACE_BEGIN() and friends expand to with -DTRACE_ENABLED. The ring
+    wraps many times over a trial, as it would in a long-running trace. */
+
+static double
+run_trace_event(void *state, uint64_t *ops)
+{
+    double start = bench_now();
+
+    for (uint64_t i = 0; i < *ops; i++)
+        trace_event("bench", 'i', 0);
+    return bench_now() - start;
+}
+
+const struct bench trace_benchmarks[] = {
+    { "trace.event", "event", 5000000, NULL, run_trace_event, NULL },
+};
+const size_t n_trace_benchmarks = sizeof(trace_benchmarks) / sizeof(trace_benchmarks[0]);
@@ -0,0 +1,20 @@
+#ifndef SUITES_H
+#define SUITES_H
+
+#include <stddef.h>
+#include "bench.h"
+
+/* Benchmarks for each component, one file each. */
+
+extern const struct bench lock_benchmarks[];        /* bench_lock.c */
+extern const size_t n_lock_benchmarks;
+extern const struct bench echo_benchmarks[];        /* bench_echo.c */
+extern const size_t n_echo_benchmarks;
+extern const struct bench resolver_benchmarks[];    /* bench_resolver.c */
+extern const size_t n_resolver_benchmarks;
+extern const struct bench inotify_benchmarks[];     /* bench_inotify.c */
+extern const size_t n_inotify_benchmarks;
+extern const struct bench trace_benchmarks[];       /* bench_trace.c */
+extern const size_t n_trace_benchmarks;
+
+#endif
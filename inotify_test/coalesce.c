@@ -0,0 +1,219 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include "coalesce.h"
+
+#define INITIAL_RECORDS 1024
+#define INITIAL_PATHS (64 * 1024)
+
+/* FNV-1a over the path string. */
+
+static uint64_t
+hash_path(const char *s)
+{
+    uint64_t h = 14695981039346656037ull;
+
+    while (*s) {
+        h ^= (unsigned char) *s++;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+int
+coalescer_init(struct coalescer *c, long window_ms)
+{
+    memset(c, 0, sizeof(*c));
+    c->window_ms = window_ms;
+    c->records_cap = INITIAL_RECORDS;
+    c->index_cap = INITIAL_RECORDS * 2;
+    c->paths_cap = INITIAL_PATHS;
+
+    c->records = malloc(c->records_cap * sizeof(*c->records));
+    c->index = calloc(c->index_cap, sizeof(*c->index));
+    c->paths = malloc(c->paths_cap);
+    if (c->records == NULL || c->index == NULL || c->paths == NULL) {
+        coalescer_free(c);
+        return -1;
+    }
+    return 0;
+}
+
+void
+coalescer_free(struct coalescer *c)
+{
+    free(c->records);
+    free(c->index);
+    free(c->paths);
+    c->records = NULL;
+    c->index = NULL;
+    c->paths = NULL;
+}
+
+/* Find the index slot holding 'path', or the empty slot where it
+    belongs. */
+
+static uint32_t *
+find_slot(struct coalescer *c, const char *path, uint64_t h)
+{
+    size_t mask = c->index_cap - 1;
+
+    for (size_t i = h & mask;; i = (i + 1) & mask) {
+        uint32_t *slot = &c->index[i];
+        if (*slot == 0 ||
+                strcmp(c->paths + c->records[*slot - 1].path_off, path) == 0)
+            return slot;
+    }
+}
+
+/* Keep the index at most half full; rebuilding it only happens while
+    a window is growing past anything seen before. */
+
+static int
+grow_index(struct coalescer *c)
+{
+    size_t cap = c->index_cap * 2;
+    uint32_t *index = calloc(cap, sizeof(*index));
+
+    if (index == NULL)
+        return -1;
+    free(c->index);
+    c->index = index;
+    c->index_cap = cap;
+    for (size_t r = 0; r < c->count; r++) {
+        const char *path = c->paths + c->records[r].path_off;
+        uint32_t *slot = find_slot(c, path, hash_path(path));
+        *slot = r + 1;
+        c->records[r].slot = slot - c->index;
+    }
+    return 0;
+}
+
+int
+coalescer_add(struct coalescer *c, const char *dir, const char *name,
+              uint32_t mask, long now_ms)
+{
+    char path[PATH_MAX];
+    size_t len;
+    uint32_t *slot;
+    uint64_t h;
+
+    if (name != NULL && *name != '\0')
+        len = snprintf(path, sizeof(path), "%s/%s", dir, name);
+    else
+        len = snprintf(path, sizeof(path), "%s", dir);
+    if (len >= sizeof(path))
+        return -1;
+
+    h = hash_path(path);
+    slot = find_slot(c, path, h);
+    if (*slot != 0) {
+        c->records[*slot - 1].mask |= mask;
+        c->records[*slot - 1].count++;
+        return 0;
+    }
+
+    /* New path in this window. */
+
+    if (c->count + 1 > c->index_cap / 2) {
+        if (grow_index(c) == -1)
+            return -1;
+        slot = find_slot(c, path, h);
+    }
+    if (c->count == c->records_cap) {
+        void *grown = realloc(c->records, 2 * c->records_cap * sizeof(*c->records));
+        if (grown == NULL)
+            return -1;
+        c->records = grown;
+        c->records_cap *= 2;
+    }
+    while (c->paths_used + len + 1 > c->paths_cap) {
+        char *grown = realloc(c->paths, 2 * c->paths_cap);
+        if (grown == NULL)
+            return -1;
+        c->paths = grown;
+        c->paths_cap *= 2;
+    }
+
+    if (c->count == 0)
+        c->window_start_ms = now_ms;
+
+    memcpy(c->paths + c->paths_used, path, len + 1);
+    c->records[c->count].path_off = c->paths_used;
+    c->records[c->count].mask = mask;
+    c->records[c->count].count = 1;
+    c->records[c->count].slot = slot - c->index;
+    c->paths_used += len + 1;
+    *slot = ++c->count;
+    return 0;
+}
+
+int
+coalescer_timeout_ms(const struct coalescer *c, long now_ms)
+{
+    long left;
+
+    if (c->count == 0)
+        return -1;
+    left = c->window_start_ms + c->window_ms - now_ms;
+    return left > 0 ? (int) left : 0;
+}
+
+void
+coalescer_flush(struct coalescer *c, change_sink_t sink, void *arg)
+{
+    struct change_record rec;
+
+    for (size_t r = 0; r < c->count; r++) {
+        rec.path = c->paths + c->records[r].path_off;
+        rec.mask = c->records[r].mask;
+        rec.count = c->records[r].count;
+        sink(&rec, arg);
+    }
+
+    /* Reset for the next window. When the window was small, clear
+        just the index slots it used instead of the whole index. */
+
+    if (c->count * 8 < c->index_cap) {
+        for (size_t r = 0; r < c->count; r++)
+            c->index[c->records[r].slot] = 0;
+    } else {
+        memset(c->index, 0, c->index_cap * sizeof(*c->index));
+    }
+    c->count = 0;
+    c->paths_used = 0;
+}
+
+/* Names for the mask bits we report, in output order. */
+
+static const struct {
+    uint32_t bit;
+    const char *name;
+} mask_names[] = {
+    { IN_Q_OVERFLOW,    "RESCAN" },
+    { IN_CREATE,        "IN_CREATE" },
+    { IN_DELETE,        "IN_DELETE" },
+    { IN_MODIFY,        "IN_MODIFY" },
+    { IN_MOVED_FROM,    "IN_MOVED_FROM" },
+    { IN_MOVED_TO,      "IN_MOVED_TO" },
+    { IN_OPEN,          "IN_OPEN" },
+    { IN_CLOSE_NOWRITE, "IN_CLOSE_NOWRITE" },
+    { IN_CLOSE_WRITE,   "IN_CLOSE_WRITE" },
+};
+
+char *
+format_mask(uint32_t mask, char *buf, size_t size)
+{
+    size_t used = 0;
+
+    buf[0] = '\0';
+    for (size_t i = 0; i < sizeof(mask_names) / sizeof(mask_names[0]); i++) {
+        if ((mask & mask_names[i].bit) && used < size) {
+            used += snprintf(buf + used, size - used, "%s%s",
+                             used ? "|" : "", mask_names[i].name);
+        }
+    }
+    return buf;
+}
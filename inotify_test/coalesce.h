@@ -0,0 +1,68 @@
+#ifndef COALESCE_H
+#define COALESCE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Merges bursts of inotify events into one change record per path.
+    Every event added during a window ORs its mask into the record for
+    its path and bumps a counter; when the window closes the records
+    are flushed in first-seen order and the table starts over. A build
+    that opens and closes the same file thousands of times produces one
+    line instead of thousands.
+
+    Records and path strings live in flat arrays that are reused from
+    one window to the next, so the steady state does no allocation. */
+
+struct change_record {
+    const char *path;       /* valid only during the flush callback */
+    uint32_t mask;          /* OR of every event mask seen for path */
+    uint32_t count;         /* number of events merged */
+};
+
+typedef void (*change_sink_t)(const struct change_record *rec, void *arg);
+
+struct coalescer {
+    long window_ms;         /* how long records collect before a flush */
+    long window_start_ms;   /* when the first record of this window arrived */
+
+    struct {                /* dense, in first-seen order */
+        size_t path_off;    /* offset into paths */
+        size_t slot;        /* where index points back at this record */
+        uint32_t mask;
+        uint32_t count;
+    } *records;
+    size_t count, records_cap;
+
+    uint32_t *index;        /* open addressing: record number + 1, 0 = empty */
+    size_t index_cap;       /* power of two */
+
+    char *paths;            /* arena of NUL-terminated paths */
+    size_t paths_used, paths_cap;
+};
+
+int coalescer_init(struct coalescer *c, long window_ms);
+void coalescer_free(struct coalescer *c);
+
+/* Record one event for dir/name (name may be NULL or empty for events
+    on the directory itself). now_ms is a CLOCK_MONOTONIC timestamp.
+    Returns 0, or -1 if memory ran out (the event is dropped). */
+int coalescer_add(struct coalescer *c, const char *dir, const char *name,
+                  uint32_t mask, long now_ms);
+
+/* Milliseconds until the current window closes: -1 if nothing is
+    pending (wait forever), 0 if a flush is due now. Suitable as a
+    poll() timeout. */
+int coalescer_timeout_ms(const struct coalescer *c, long now_ms);
+
+/* Hand every pending record to sink, then start a new window. */
+void coalescer_flush(struct coalescer *c, change_sink_t sink, void *arg);
+
+/* Big enough for every name format_mask() knows, joined by '|'. */
+#define MASK_NAMES_MAX 128
+
+/* Write the names of the reported bits in 'mask' to buf as
+    "IN_OPEN|IN_CLOSE_WRITE", truncating to size. Returns buf. */
+char *format_mask(uint32_t mask, char *buf, size_t size);
+
+#endif
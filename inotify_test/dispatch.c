@@ -0,0 +1,301 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include "dispatch.h"
+#include "trace.h"
+
+/* Queue records are a header followed by "dir\0name\0", padded to a
+    multiple of the header size. A record never wraps around the end of
+    the ring: if it does not fit, a pad record (mask 0, which no real
+    event has) fills the rest and the record starts again at offset 0.
+    Because everything is a multiple of the header size, whatever space
+    is left at the end always has room for a pad header. */
+
+struct record {
+    uint32_t size;                  /* whole record, header included */
+    uint32_t mask;                  /* 0 = padding */
+    int64_t now_ms;
+    char paths[];
+};
+
+#define RECORD_ALIGN sizeof(struct record)
+#define WORKER_BATCH 1024           /* records per pass before checking the clock */
+
+static long
+now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+/* Sleep until woken, while *word is still val, for at most timeout_ms
+    (-1: no limit). Spurious returns are fine; callers recheck. */
+
+static void
+futex_wait(_Atomic uint32_t *word, uint32_t val, int timeout_ms)
+{
+    struct timespec ts = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+
+    syscall(SYS_futex, (uint32_t *) word, FUTEX_WAIT_PRIVATE, val,
+            timeout_ms >= 0 ? &ts : NULL, NULL, 0);
+}
+
+static void
+futex_wake(_Atomic uint32_t *word)
+{
+    syscall(SYS_futex, (uint32_t *) word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+/* Wake the shard's worker if it went to sleep on an empty queue. The
+    seq_cst fence pairs with the one in worker(): either we see its
+    sleeping flag, or it sees what we just published. */
+
+static void
+wake_worker(struct dispatch_shard *s)
+{
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&s->sleeping, memory_order_relaxed) &&
+            atomic_exchange_explicit(&s->sleeping, 0, memory_order_relaxed))
+        futex_wake(&s->sleeping);
+}
+
+static int
+queue_push(struct dispatch_queue *q, const char *dir, const char *name,
+           uint32_t mask, long now)
+{
+    size_t dir_len = strlen(dir), name_len = name ? strlen(name) : 0;
+    size_t need = sizeof(struct record) + dir_len + 1 + name_len + 1;
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+    size_t to_end = q->size - (head & (q->size - 1));
+    struct record *r;
+
+    need = (need + RECORD_ALIGN - 1) & ~(RECORD_ALIGN - 1);
+    if (q->size - (head - tail) < need + (to_end < need ? to_end : 0))
+        return -1;
+
+    if (to_end < need) {
+        r = (struct record *) (q->ring + (head & (q->size - 1)));
+        r->size = to_end;
+        r->mask = 0;
+        head += to_end;
+    }
+
+    r = (struct record *) (q->ring + (head & (q->size - 1)));
+    r->size = need;
+    r->mask = mask;
+    r->now_ms = now;
+    memcpy(r->paths, dir, dir_len + 1);
+    if (name_len)
+        memcpy(r->paths + dir_len + 1, name, name_len + 1);
+    else
+        r->paths[dir_len + 1] = '\0';
+
+    /* Publish: the consumer's acquire load of head sees the record. */
+
+    atomic_store_explicit(&q->head, head + need, memory_order_release);
+    return 0;
+}
+
+/* Oldest unconsumed record, or NULL if the queue is empty. Pad records
+    are skipped (and consumed) on the way. */
+
+static struct record *
+queue_peek(struct dispatch_queue *q)
+{
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&q->head, memory_order_acquire);
+    struct record *r;
+
+    while (tail != head) {
+        r = (struct record *) (q->ring + (tail & (q->size - 1)));
+        if (r->mask != 0)
+            return r;
+        tail += r->size;
+        atomic_store_explicit(&q->tail, tail, memory_order_release);
+    }
+    return NULL;
+}
+
+static void
+queue_pop(struct dispatch_queue *q, const struct record *r)
+{
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+
+    /* Release: the producer may reuse these bytes only after we are
+        done reading them. */
+
+    atomic_store_explicit(&q->tail, tail + r->size, memory_order_release);
+}
+
+static void *
+worker(void *arg)
+{
+    struct dispatch_shard *s = arg;
+    struct dispatcher *d = s->d;
+
+    TRACE_THREAD_NAME("dispatch");
+    for (;;) {
+        struct record *r;
+        int n = 0, timeout;
+        long now;
+
+        while (n < WORKER_BATCH && (r = queue_peek(&s->queue)) != NULL) {
+            const char *dir = r->paths;
+            const char *name = dir + strlen(dir) + 1;
+
+            coalescer_add(&s->coalescer, dir, name, r->mask, r->now_ms);
+            queue_pop(&s->queue, r);
+            n++;
+        }
+        if (n) {
+            atomic_store_explicit(&s->popped,
+                atomic_load_explicit(&s->popped, memory_order_relaxed) + n,
+                memory_order_relaxed);
+            TRACE_COUNTER("dispatch_batch", n);
+        }
+
+        now = now_ms();
+        timeout = coalescer_timeout_ms(&s->coalescer, now);
+        if (timeout == 0) {
+            TRACE_BEGIN("dispatch_flush");
+            d->flush(&s->coalescer, d->flush_arg);
+            TRACE_END("dispatch_flush");
+            timeout = -1;
+        }
+        if (n)
+            continue;
+
+        /* Nothing queued. The stop flag is only honoured once the
+            queue is empty, so events pushed before stopping still get
+            through. Checked before the queue so none slip in between. */
+
+        if (atomic_load_explicit(&d->stopping, memory_order_acquire)) {
+            if (queue_peek(&s->queue) != NULL)
+                continue;
+            break;
+        }
+
+        /* Sleep until the producer pushes or the window closes. The
+            flag goes up before the last look at the queue, so a push
+            that lands in between either shows up here or wakes us. */
+
+        atomic_store_explicit(&s->sleeping, 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (queue_peek(&s->queue) == NULL &&
+                !atomic_load_explicit(&d->stopping, memory_order_acquire))
+            futex_wait(&s->sleeping, 1, timeout);
+        atomic_store_explicit(&s->sleeping, 0, memory_order_relaxed);
+    }
+
+    d->flush(&s->coalescer, d->flush_arg);
+    return NULL;
+}
+
+int
+dispatcher_start(struct dispatcher *d, int n_shards, long window_ms,
+                 dispatch_flush_t flush, void *arg)
+{
+    int i, err;
+
+    memset(d, 0, sizeof(*d));
+    d->flush = flush;
+    d->flush_arg = arg;
+    d->shards = aligned_alloc(64, n_shards * sizeof(*d->shards));
+    if (d->shards == NULL)
+        return -1;
+    memset(d->shards, 0, n_shards * sizeof(*d->shards));
+
+    for (i = 0; i < n_shards; i++) {
+        struct dispatch_shard *s = &d->shards[i];
+
+        s->d = d;
+        s->queue.size = DISPATCH_QUEUE_BYTES;
+        s->queue.ring = aligned_alloc(RECORD_ALIGN, DISPATCH_QUEUE_BYTES);
+        if (s->queue.ring == NULL)
+            break;
+        if (coalescer_init(&s->coalescer, window_ms) == -1) {
+            free(s->queue.ring);
+            break;
+        }
+        if ((err = pthread_create(&s->thread, NULL, worker, s)) != 0) {
+            coalescer_free(&s->coalescer);
+            free(s->queue.ring);
+            errno = err;
+            break;
+        }
+        d->n_shards++;
+    }
+    if (d->n_shards < n_shards) {
+        int saved = errno;
+
+        dispatcher_stop(d);
+        dispatcher_free(d);
+        errno = saved;
+        return -1;
+    }
+    return 0;
+}
+
+int
+dispatcher_push(struct dispatcher *d, int wd, const char *dir,
+                const char *name, uint32_t mask, long now_ms)
+{
+    struct dispatch_shard *s = &d->shards[(unsigned) wd % d->n_shards];
+    unsigned long pushed, depth;
+
+    if (queue_push(&s->queue, dir, name, mask, now_ms) == -1) {
+        atomic_store_explicit(&s->dropped,
+            atomic_load_explicit(&s->dropped, memory_order_relaxed) + 1,
+            memory_order_relaxed);
+        return -1;
+    }
+
+    pushed = atomic_load_explicit(&s->pushed, memory_order_relaxed) + 1;
+    atomic_store_explicit(&s->pushed, pushed, memory_order_relaxed);
+    depth = pushed - atomic_load_explicit(&s->popped, memory_order_relaxed);
+    if (depth > atomic_load_explicit(&s->max_depth, memory_order_relaxed))
+        atomic_store_explicit(&s->max_depth, depth, memory_order_relaxed);
+    wake_worker(s);
+    return 0;
+}
+
+void
+dispatcher_stats(struct dispatcher *d, int shard, struct dispatch_stats *out)
+{
+    struct dispatch_shard *s = &d->shards[shard];
+
+    out->processed = atomic_load_explicit(&s->popped, memory_order_relaxed);
+    out->pushed = atomic_load_explicit(&s->pushed, memory_order_relaxed);
+    out->dropped = atomic_load_explicit(&s->dropped, memory_order_relaxed);
+    out->max_depth = atomic_load_explicit(&s->max_depth, memory_order_relaxed);
+    out->depth = out->pushed > out->processed ? out->pushed - out->processed : 0;
+}
+
+void
+dispatcher_stop(struct dispatcher *d)
+{
+    atomic_store_explicit(&d->stopping, 1, memory_order_release);
+    for (int i = 0; i < d->n_shards; i++) {
+        struct dispatch_shard *s = &d->shards[i];
+
+        wake_worker(s);
+        pthread_join(s->thread, NULL);
+        coalescer_free(&s->coalescer);
+        free(s->queue.ring);
+    }
+}
+
+void
+dispatcher_free(struct dispatcher *d)
+{
+    free(d->shards);
+    d->shards = NULL;
+    d->n_shards = 0;
+}
@@ -0,0 +1,97 @@
+#ifndef DISPATCH_H
+#define DISPATCH_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "coalesce.h"
+
+/* Sharded event dispatch. The thread that reads inotify only parses
+    events and pushes them here; a fixed set of worker threads does
+    everything else (coalescing, printing, logging, indexing), so slow
+    per-event work no longer holds up draining the kernel queue.
+
+    Events are sharded by watch descriptor: all events of one directory
+    go to the same worker, in order, while different directories are
+    handled in parallel, so output from different directories no longer
+    follows the kernel's order and each shard flushes its own windows.
+    That is why the watcher only shards when asked to (-t).
+
+    Each shard has its own coalescer and its own bounded
+    single-producer/single-consumer queue, a lock-free ring of
+    variable-size records. When a queue is full the event is dropped and
+    counted rather than blocking the reader; the caller should treat a
+    drop like a kernel queue overflow and rescan. */
+
+#define DISPATCH_QUEUE_BYTES (1024 * 1024)     /* per shard, power of two */
+
+/* Called by a worker when its coalescing window closes (and once more
+    at shutdown) to flush the shard's records. Runs concurrently on
+    every worker, so it must be thread-safe. */
+typedef void (*dispatch_flush_t)(struct coalescer *c, void *arg);
+
+struct dispatch_queue {
+    char *ring;
+    size_t size;                    /* bytes, power of two */
+    _Alignas(64) _Atomic size_t head;   /* bytes pushed; producer writes */
+    _Alignas(64) _Atomic size_t tail;   /* bytes popped; consumer writes */
+};
+
+struct dispatch_shard {
+    struct dispatch_queue queue;
+    struct coalescer coalescer;     /* worker-private */
+    pthread_t thread;
+    struct dispatcher *d;
+
+    /* Counters, each written by one side only. */
+    _Alignas(64) _Atomic unsigned long pushed;      /* producer */
+    _Atomic unsigned long dropped;                  /* producer */
+    _Atomic unsigned long max_depth;                /* producer */
+    _Alignas(64) _Atomic unsigned long popped;      /* consumer */
+
+    /* Futex word: 1 while the worker is asleep (or about to be) on an
+        empty queue. The producer only makes the wake-up system call
+        when it finds it set, i.e. on the empty -> non-empty transition. */
+    _Atomic uint32_t sleeping;
+};
+
+struct dispatcher {
+    int n_shards;
+    struct dispatch_shard *shards;
+    dispatch_flush_t flush;
+    void *flush_arg;
+    _Atomic int stopping;
+};
+
+struct dispatch_stats {
+    unsigned long pushed;           /* events queued */
+    unsigned long processed;        /* events handed to the coalescer */
+    unsigned long dropped;          /* events lost to a full queue */
+    unsigned long depth;            /* events waiting right now */
+    unsigned long max_depth;        /* most ever waiting */
+};
+
+/* Start n_shards workers, each coalescing over window_ms and handing
+    closed windows to flush(coalescer, arg). Returns 0, or -1 with errno
+    set. */
+int dispatcher_start(struct dispatcher *d, int n_shards, long window_ms,
+                     dispatch_flush_t flush, void *arg);
+
+/* Queue one event for dir/name (name may be NULL) on the shard for wd.
+    Only one thread may push. Returns 0, or -1 if the shard's queue was
+    full and the event was dropped. */
+int dispatcher_push(struct dispatcher *d, int wd, const char *dir,
+                    const char *name, uint32_t mask, long now_ms);
+
+/* Snapshot of one shard's counters. Safe to call from the pushing thread
+    while the workers run. */
+void dispatcher_stats(struct dispatcher *d, int shard, struct dispatch_stats *out);
+
+/* Let the workers drain their queues and flush, then join them. The
+    counters stay readable through dispatcher_stats() until
+    dispatcher_free(). */
+void dispatcher_stop(struct dispatcher *d);
+void dispatcher_free(struct dispatcher *d);
+
+#endif
@@ -0,0 +1,229 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "eventlog.h"
+
+static size_t
+segment_size(uint32_t records_per_segment)
+{
+    return EVENTLOG_HEADER_SIZE +
+           (size_t) records_per_segment * sizeof(struct eventlog_record);
+}
+
+static struct eventlog_record *
+records_of(const struct eventlog_segment_header *seg)
+{
+    return (struct eventlog_record *) ((char *) seg + EVENTLOG_HEADER_SIZE);
+}
+
+/* Map segment 'index' of the log in 'dir'. With 'create', a missing
+    file is created and sized and its header written. Returns the
+    mapping or NULL with errno set. */
+
+static struct eventlog_segment_header *
+map_segment(const char *dir, uint32_t index, int create, uint32_t n_segments,
+            uint32_t records_per_segment)
+{
+    struct eventlog_segment_header *seg;
+    char path[PATH_MAX];
+    struct stat sb;
+    size_t size;
+    int fd, fresh = 0;
+
+    snprintf(path, sizeof(path), "%s/seg-%03u", dir, index);
+    fd = open(path, (create ? O_RDWR | O_CREAT : O_RDONLY) | O_CLOEXEC, 0644);
+    if (fd == -1 || fstat(fd, &sb) == -1)
+        goto fail;
+
+    if (create && sb.st_size == 0) {
+        size = segment_size(records_per_segment);
+        if (ftruncate(fd, size) == -1)      /* sparse: pages fill in as used */
+            goto fail;
+        fresh = 1;
+    } else {
+        size = sb.st_size;
+        if (size < EVENTLOG_HEADER_SIZE) {
+            errno = EINVAL;
+            goto fail;
+        }
+    }
+
+    seg = mmap(NULL, size, create ? PROT_READ | PROT_WRITE : PROT_READ,
+               MAP_SHARED, fd, 0);
+    if (seg == MAP_FAILED)
+        goto fail;
+    close(fd);
+
+    if (fresh) {
+        memcpy(seg->magic, EVENTLOG_MAGIC, sizeof(seg->magic));
+        seg->version = EVENTLOG_VERSION;
+        seg->record_size = sizeof(struct eventlog_record);
+        seg->records_per_segment = records_per_segment;
+        seg->n_segments = n_segments;
+        seg->index = index;
+    }
+
+    /* Same format, same geometry, complete file. */
+
+    if (memcmp(seg->magic, EVENTLOG_MAGIC, sizeof(seg->magic)) != 0 ||
+            seg->version != EVENTLOG_VERSION ||
+            seg->record_size != sizeof(struct eventlog_record) ||
+            seg->index != index ||
+            (n_segments && seg->n_segments != n_segments) ||
+            (records_per_segment && seg->records_per_segment != records_per_segment) ||
+            segment_size(seg->records_per_segment) != size) {
+        munmap(seg, size);
+        errno = EINVAL;
+        return NULL;
+    }
+    return seg;
+
+fail:
+    if (fd != -1) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+    }
+    return NULL;
+}
+
+static int
+map_all(struct eventlog *log, const char *dir, int create, uint32_t n_segments,
+        uint32_t records_per_segment)
+{
+    struct eventlog_segment_header *first;
+
+    memset(log, 0, sizeof(*log));
+    log->writable = create;
+
+    /* seg-000 tells a reader the geometry of the rest. */
+
+    first = map_segment(dir, 0, create, n_segments, records_per_segment);
+    if (first == NULL)
+        return -1;
+    log->n_segments = first->n_segments;
+    log->records_per_segment = first->records_per_segment;
+    if (log->n_segments == 0 || log->records_per_segment == 0) {
+        munmap(first, segment_size(first->records_per_segment));
+        errno = EINVAL;
+        return -1;
+    }
+
+    log->segments = calloc(log->n_segments, sizeof(*log->segments));
+    if (log->segments == NULL) {
+        munmap(first, segment_size(log->records_per_segment));
+        return -1;
+    }
+    log->segments[0] = first;
+    log->head = &first->head;
+
+    for (uint32_t i = 1; i < log->n_segments; i++) {
+        log->segments[i] = map_segment(dir, i, create, log->n_segments,
+                                       log->records_per_segment);
+        if (log->segments[i] == NULL) {
+            int saved = errno;
+            eventlog_close(log);
+            errno = saved;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int
+eventlog_create(struct eventlog *log, const char *dir, uint32_t n_segments,
+                uint32_t records_per_segment)
+{
+    if (mkdir(dir, 0755) == -1 && errno != EEXIST)
+        return -1;
+    return map_all(log, dir, 1, n_segments, records_per_segment);
+}
+
+int
+eventlog_open(struct eventlog *log, const char *dir)
+{
+    return map_all(log, dir, 0, 0, 0);
+}
+
+void
+eventlog_close(struct eventlog *log)
+{
+    size_t size = segment_size(log->records_per_segment);
+
+    for (uint32_t i = 0; i < log->n_segments && log->segments; i++) {
+        if (log->segments[i] == NULL)
+            continue;
+        if (log->writable)
+            msync(log->segments[i], size, MS_ASYNC);
+        munmap(log->segments[i], size);
+    }
+    free(log->segments);
+    memset(log, 0, sizeof(*log));
+}
+
+const struct eventlog_record *
+eventlog_slot(const struct eventlog *log, uint64_t seq)
+{
+    uint32_t segment = (seq / log->records_per_segment) % log->n_segments;
+
+    return &records_of(log->segments[segment])[seq % log->records_per_segment];
+}
+
+uint64_t
+eventlog_head(const struct eventlog *log)
+{
+    return atomic_load_explicit(log->head, memory_order_acquire);
+}
+
+uint64_t
+eventlog_tail(const struct eventlog *log)
+{
+    uint64_t head = eventlog_head(log);
+    uint64_t capacity = (uint64_t) log->n_segments * log->records_per_segment;
+
+    return head > capacity ? head - capacity : 0;
+}
+
+uint64_t
+eventlog_append(struct eventlog *log, const char *path, uint32_t mask,
+                uint32_t count)
+{
+    uint64_t seq = atomic_fetch_add_explicit(log->head, 1, memory_order_relaxed);
+    struct eventlog_record *rec = (struct eventlog_record *) eventlog_slot(log, seq);
+    size_t len = strlen(path);
+    struct timespec ts;
+
+    /* seq was claimed by moving head first, so writers fill in their
+        records in parallel and readers wait on each slot's own seq.
+        Open that seqlock: a reader still looking at the record this
+        slot held a lap ago will see it change under it. */
+
+    atomic_store_explicit(&rec->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    rec->time_ns = (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+    rec->mask = mask;
+    rec->count = count;
+    rec->flags = 0;
+    rec->reserved = 0;
+    if (len >= EVENTLOG_PATH_MAX) {
+        len = EVENTLOG_PATH_MAX - 1;
+        rec->flags |= EVENTLOG_TRUNCATED;
+    }
+    memcpy(rec->path, path, len);
+    rec->path[len] = '\0';
+    rec->path_len = len;
+
+    /* Publish the record. */
+
+    atomic_store_explicit(&rec->seq, seq + 1, memory_order_release);
+    return seq;
+}
@@ -0,0 +1,107 @@
+#ifndef EVENTLOG_H
+#define EVENTLOG_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Memory-mapped binary event log. Change records are appended as
+    fixed-layout 256-byte records to a ring of segment files in a log
+    directory (seg-000, seg-001, ...). Every record carries a sequence
+    number that increases monotonically for the life of the log, across
+    watcher restarts, so record 'seq' always lives at a computable place:
+        segment (seq / records_per_segment) % n_segments
+        slot    seq % records_per_segment
+    Readers map the same files read-only and tail them without locks
+    and without copying records out of the mapping; any number of them
+    can run at once, each resuming from its own stored sequence number.
+
+    Each slot is a seqlock: the writer zeroes the slot's seq, fills in
+    the record, then publishes seq + 1 with release ordering. A reader
+    that sees the expected value before and after looking at a record
+    knows the record was complete and not overwritten meanwhile.
+
+    Several threads of the writing process may append at once: each
+    claims its sequence number by advancing head atomically, so head
+    can run ahead of records still being filled in. Readers that find a
+    record below head not yet valid simply look again later. */
+
+#define EVENTLOG_MAGIC "INOLOG01"
+#define EVENTLOG_VERSION 1
+#define EVENTLOG_HEADER_SIZE 4096   /* page-aligned records follow */
+#define EVENTLOG_PATH_MAX 224       /* longer paths are truncated and flagged */
+#define EVENTLOG_TRUNCATED 0x1
+
+#define EVENTLOG_DEFAULT_SEGMENTS 8
+#define EVENTLOG_DEFAULT_RECORDS (16 * 1024)    /* per segment: 4MB files */
+
+struct eventlog_record {
+    _Atomic uint64_t seq;           /* seq + 1 once published, 0 while written */
+    uint64_t time_ns;               /* CLOCK_REALTIME */
+    uint32_t mask;                  /* IN_* bits, as printed by the watcher */
+    uint32_t count;                 /* events coalesced into this record */
+    uint16_t path_len;
+    uint16_t flags;
+    uint32_t reserved;
+    char path[EVENTLOG_PATH_MAX];   /* NUL-terminated */
+};
+
+_Static_assert(sizeof(struct eventlog_record) == 256, "record layout changed");
+
+struct eventlog_segment_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t records_per_segment;
+    uint32_t n_segments;
+    uint32_t index;                 /* which segment this file is */
+    uint32_t reserved;
+    _Atomic uint64_t head;          /* next seq to be written; kept in seg-000 */
+};
+
+struct eventlog {
+    int writable;
+    uint32_t n_segments;
+    uint32_t records_per_segment;
+    struct eventlog_segment_header **segments;      /* mapped files */
+    _Atomic uint64_t *head;         /* &segments[0]->head */
+};
+
+/* Open (creating if needed) the log in 'dir' for appending. An existing
+    log must have the same geometry; appending continues after its last
+    record. Returns 0, or -1 with errno set. */
+int eventlog_create(struct eventlog *log, const char *dir, uint32_t n_segments,
+                    uint32_t records_per_segment);
+
+/* Open an existing log read-only, geometry taken from the files. */
+int eventlog_open(struct eventlog *log, const char *dir);
+
+void eventlog_close(struct eventlog *log);
+
+/* Append one record. Thread-safe, but only one process may append to a
+    log. Returns the record's sequence number. */
+uint64_t eventlog_append(struct eventlog *log, const char *path, uint32_t mask,
+                         uint32_t count);
+
+/* Sequence number the next append will get. Records just below it
+    may still be being written. */
+uint64_t eventlog_head(const struct eventlog *log);
+
+/* Oldest sequence number still held by the ring. */
+uint64_t eventlog_tail(const struct eventlog *log);
+
+/* Pointer to the slot for 'seq', inside the mapping. Use
+    eventlog_record_valid() before trusting it and again after reading
+    it. */
+const struct eventlog_record *eventlog_slot(const struct eventlog *log,
+                                            uint64_t seq);
+
+/* 1 if 'rec' currently holds complete record 'seq'. */
+static inline int
+eventlog_record_valid(const struct eventlog_record *rec, uint64_t seq)
+{
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&rec->seq, memory_order_acquire) == seq + 1;
+}
+
+#endif
@@ -0,0 +1,297 @@
+#define _GNU_SOURCE                 /* open_by_handle_at, struct file_handle */
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/statfs.h>
+#include <unistd.h>
+#include "fanotify_backend.h"
+
+/* Same events the inotify backend reports, on files and directories
+    alike. */
+
+#define FAN_REPORTED (FAN_OPEN | FAN_CLOSE | FAN_CREATE | FAN_MOVED_TO | FAN_ONDIR)
+
+/* What we subscribe to: moves away are only needed to keep the handle
+    cache honest, they are not reported. */
+
+#define FAN_MASK (FAN_REPORTED | FAN_MOVED_FROM)
+
+/* Mount marks cannot report directory entry events. */
+
+#define FAN_MOUNT_MASK (FAN_OPEN | FAN_CLOSE | FAN_ONDIR)
+
+/* The event bits are passed straight to the coalescer as IN_* bits. */
+
+_Static_assert(FAN_OPEN == IN_OPEN && FAN_CLOSE_WRITE == IN_CLOSE_WRITE &&
+               FAN_CLOSE_NOWRITE == IN_CLOSE_NOWRITE &&
+               FAN_CREATE == IN_CREATE && FAN_MOVED_TO == IN_MOVED_TO &&
+               FAN_MOVED_FROM == IN_MOVED_FROM &&
+               FAN_Q_OVERFLOW == IN_Q_OVERFLOW && FAN_ONDIR == IN_ISDIR,
+               "fanotify and inotify event bits differ");
+
+int
+fan_backend_open(struct fan_backend *fb, char *const paths[], int n_paths)
+{
+    int saved;
+
+    memset(fb, 0, sizeof(*fb));
+    fb->whole_fs = 1;
+
+    fb->fd = fanotify_init(FAN_CLASS_NOTIF | FAN_REPORT_DFID_NAME |
+                           FAN_NONBLOCK, O_RDONLY | O_LARGEFILE);
+    if (fb->fd == -1)
+        return -1;
+
+    fb->roots = calloc(n_paths, sizeof(char *));
+    if (fb->roots == NULL)
+        goto fail;
+
+    for (int i = 0; i < n_paths; i++) {
+        struct statfs sfs;
+        __kernel_fsid_t fsid;
+        size_t m;
+        int mount_fd;
+
+        if ((fb->roots[fb->n_roots] = realpath(paths[i], NULL)) == NULL)
+            goto fail;
+        fb->n_roots++;
+
+        if ((mount_fd = open(paths[i], O_RDONLY | O_DIRECTORY)) == -1)
+            goto fail;
+        if (fstatfs(mount_fd, &sfs) == -1) {
+            close(mount_fd);
+            goto fail;
+        }
+        memcpy(&fsid, &sfs.f_fsid, sizeof(fsid));
+
+        /* One mark covers every PATH on the same filesystem. */
+
+        for (m = 0; m < fb->n_mounts; m++)
+            if (memcmp(&fb->mounts[m].fsid, &fsid, sizeof(fsid)) == 0)
+                break;
+        if (m < fb->n_mounts) {
+            close(mount_fd);
+            continue;
+        }
+        if (m == FAN_MAX_MOUNTS) {
+            close(mount_fd);
+            errno = EMFILE;
+            goto fail;
+        }
+
+        if (fanotify_mark(fb->fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM,
+                          FAN_MASK, AT_FDCWD, paths[i]) == -1) {
+
+            /* Some filesystems (e.g. btrfs subvolumes) refuse
+                filesystem marks; a mount mark still sees open/close. */
+
+            if (fanotify_mark(fb->fd, FAN_MARK_ADD | FAN_MARK_MOUNT,
+                              FAN_MOUNT_MASK, AT_FDCWD, paths[i]) == -1) {
+                close(mount_fd);
+                goto fail;
+            }
+            fb->whole_fs = 0;
+        }
+        fb->mounts[m].fsid = fsid;
+        fb->mounts[m].fd = mount_fd;
+        fb->n_mounts++;
+    }
+    return 0;
+
+fail:
+    saved = errno;
+    fan_backend_close(fb);
+    errno = saved;
+    return -1;
+}
+
+void
+fan_backend_close(struct fan_backend *fb)
+{
+    for (size_t i = 0; i < fb->n_mounts; i++)
+        close(fb->mounts[i].fd);
+    for (size_t i = 0; i < fb->n_roots; i++)
+        free(fb->roots[i]);
+    for (size_t i = 0; i < FAN_HANDLE_CACHE; i++) {
+        free(fb->cache[i].key);
+        free(fb->cache[i].path);
+    }
+    free(fb->roots);
+    if (fb->fd != -1)
+        close(fb->fd);
+    memset(fb, 0, sizeof(*fb));
+    fb->fd = -1;
+}
+
+static void
+cache_clear(struct fan_backend *fb)
+{
+    for (size_t i = 0; i < FAN_HANDLE_CACHE; i++) {
+        free(fb->cache[i].key);
+        free(fb->cache[i].path);
+        fb->cache[i].key = NULL;
+        fb->cache[i].path = NULL;
+    }
+}
+
+/* Turn a directory file handle back into a path. A cache hit costs a
+    hash and a memcmp; a miss costs open_by_handle_at() plus a readlink()
+    of the resulting fd. Returns NULL if the directory is already gone. */
+
+static const char *
+resolve_dir(struct fan_backend *fb, const struct fanotify_event_info_fid *fid)
+{
+    struct file_handle *handle = (struct file_handle *) fid->handle;
+    size_t key_len = sizeof(fid->fsid) + sizeof(*handle) + handle->handle_bytes;
+    const unsigned char *key = (const unsigned char *) &fid->fsid;
+    uint64_t h = 14695981039346656037ull;
+    size_t slot, m;
+    char proc[64], path[PATH_MAX];
+    ssize_t len;
+    int fd;
+
+    /* fsid, then the handle header and bytes: contiguous in the record. */
+
+    for (size_t i = 0; i < key_len; i++) {
+        h ^= key[i];
+        h *= 1099511628211ull;
+    }
+    slot = h & (FAN_HANDLE_CACHE - 1);
+    if (fb->cache[slot].key != NULL && fb->cache[slot].key_len == key_len &&
+            memcmp(fb->cache[slot].key, key, key_len) == 0)
+        return fb->cache[slot].path;
+
+    for (m = 0; m < fb->n_mounts; m++)
+        if (memcmp(&fb->mounts[m].fsid, &fid->fsid, sizeof(fid->fsid)) == 0)
+            break;
+    if (m == fb->n_mounts)
+        return NULL;
+
+    fd = open_by_handle_at(fb->mounts[m].fd, handle, O_PATH);
+    if (fd == -1)
+        return NULL;
+    snprintf(proc, sizeof(proc), "/proc/self/fd/%d", fd);
+    len = readlink(proc, path, sizeof(path) - 1);
+    close(fd);
+    if (len == -1)
+        return NULL;
+    path[len] = '\0';
+
+    free(fb->cache[slot].key);
+    free(fb->cache[slot].path);
+    fb->cache[slot].key = malloc(key_len);
+    fb->cache[slot].path = strdup(path);
+    if (fb->cache[slot].key == NULL || fb->cache[slot].path == NULL) {
+        free(fb->cache[slot].key);
+        free(fb->cache[slot].path);
+        fb->cache[slot].key = NULL;
+        fb->cache[slot].path = NULL;
+        return NULL;
+    }
+    memcpy(fb->cache[slot].key, key, key_len);
+    fb->cache[slot].key_len = key_len;
+    return fb->cache[slot].path;
+}
+
+/* Is 'path' one of the requested PATHs or below one? */
+
+static int
+in_roots(const struct fan_backend *fb, const char *path)
+{
+    for (size_t i = 0; i < fb->n_roots; i++) {
+        size_t len = strlen(fb->roots[i]);
+
+        if (len == 1)               /* "/" */
+            return 1;
+        if (strncmp(path, fb->roots[i], len) == 0 &&
+                (path[len] == '\0' || path[len] == '/'))
+            return 1;
+    }
+    return 0;
+}
+
+void
+fan_backend_read(struct fan_backend *fb, char *buf, size_t buf_size,
+                 struct coalescer *c, long now_ms)
+{
+    const struct fanotify_event_metadata *meta;
+    ssize_t len;
+
+    for (;;) {
+        len = read(fb->fd, buf, buf_size);
+        if (len == -1 && errno != EAGAIN) {
+            perror("read");
+            exit(EXIT_FAILURE);
+        }
+        if (len <= 0)
+            break;
+
+        for (meta = (const struct fanotify_event_metadata *) buf;
+                FAN_EVENT_OK(meta, len); meta = FAN_EVENT_NEXT(meta, len)) {
+            const struct fanotify_event_info_fid *fid = NULL;
+            const char *dir, *name = NULL;
+
+            if (meta->vers != FANOTIFY_METADATA_VERSION) {
+                fprintf(stderr, "fanotify: unexpected metadata version %d\n",
+                        meta->vers);
+                exit(EXIT_FAILURE);
+            }
+            if (meta->fd >= 0)
+                close(meta->fd);
+
+            /* No handles to rescan with: ask consumers to rescan every
+                PATH instead. */
+
+            if (meta->mask & FAN_Q_OVERFLOW) {
+                fb->overflows++;
+                for (size_t i = 0; i < fb->n_roots; i++)
+                    coalescer_add(c, fb->roots[i], NULL,
+                                  IN_Q_OVERFLOW | IN_ISDIR, now_ms);
+                continue;
+            }
+
+            /* Find the directory handle (+ name) info record. */
+
+            for (const char *info = (const char *) (meta + 1);
+                    info < (const char *) meta + meta->event_len;) {
+                const struct fanotify_event_info_header *hdr =
+                    (const struct fanotify_event_info_header *) info;
+
+                if (hdr->len == 0)
+                    break;
+                if (hdr->info_type == FAN_EVENT_INFO_TYPE_DFID_NAME ||
+                        hdr->info_type == FAN_EVENT_INFO_TYPE_DFID) {
+                    fid = (const struct fanotify_event_info_fid *) hdr;
+                    if (hdr->info_type == FAN_EVENT_INFO_TYPE_DFID_NAME) {
+                        const struct file_handle *handle =
+                            (const struct file_handle *) fid->handle;
+                        name = (const char *) handle->f_handle +
+                               handle->handle_bytes;
+                    }
+                    break;
+                }
+                info += hdr->len;
+            }
+            if (fid == NULL || (dir = resolve_dir(fb, fid)) == NULL)
+                continue;
+
+            /* "." names the directory itself. */
+
+            if (name != NULL && strcmp(name, ".") == 0)
+                name = NULL;
+            if (in_roots(fb, dir) && (meta->mask & FAN_REPORTED & ~FAN_ONDIR))
+                coalescer_add(c, dir, name, meta->mask & FAN_REPORTED, now_ms);
+
+            /* A renamed directory invalidates every cached path below
+                it. 'dir' points into the cache, so this goes last. */
+
+            if ((meta->mask & FAN_ONDIR) && (meta->mask & FAN_MOVE))
+                cache_clear(fb);
+        }
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef FANOTIFY_BACKEND_H
+#define FANOTIFY_BACKEND_H
+
+#include <stddef.h>
+#include <sys/fanotify.h>
+#include "coalesce.h"
+
+/* fanotify backend: one FAN_MARK_FILESYSTEM mark per filesystem
+    instead of one inotify watch per directory, so startup cost and
+    kernel memory no longer grow with the size of the tree.
+
+    Events carry the parent directory as a file handle plus the entry
+    name (FAN_REPORT_DFID_NAME). Handles are turned back into paths with
+    open_by_handle_at(), which needs CAP_DAC_READ_SEARCH, and cached.
+    Events outside the requested PATHs are filtered out. The fanotify
+    event bits we ask for have the same values as their IN_* twins, so
+    the coalescer and the output are shared with the inotify backend. */
+
+#define FAN_MAX_MOUNTS 16
+#define FAN_HANDLE_CACHE 4096       /* direct-mapped, power of two */
+
+struct fan_backend {
+    int fd;                         /* fanotify instance */
+    int whole_fs;                   /* FAN_MARK_FILESYSTEM (else FAN_MARK_MOUNT) */
+
+    size_t n_mounts;                /* one open fd per marked filesystem, */
+    struct {                        /* used to resolve its file handles */
+        __kernel_fsid_t fsid;
+        int fd;
+    } mounts[FAN_MAX_MOUNTS];
+
+    char **roots;                   /* canonical PATHs, for filtering */
+    size_t n_roots;
+
+    struct {                        /* directory handle -> path cache */
+        unsigned char *key;         /* fsid + handle bytes */
+        size_t key_len;
+        char *path;
+    } cache[FAN_HANDLE_CACHE];
+
+    unsigned long overflows;
+};
+
+/* Start watching the filesystems holding 'paths'. Returns 0, or -1
+    with errno set when fanotify is missing or not permitted (EPERM,
+    ENOSYS, EINVAL on old kernels), in which case the caller should use
+    the inotify backend instead. */
+int fan_backend_open(struct fan_backend *fb, char *const paths[], int n_paths);
+
+/* Drain all pending events into the coalescer, using buf as the read
+    buffer. */
+void fan_backend_read(struct fan_backend *fb, char *buf, size_t buf_size,
+                      struct coalescer *c, long now_ms);
+
+void fan_backend_close(struct fan_backend *fb);
+
+#endif
@@ -0,0 +1,544 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "indexer.h"
+
+/* Files are hashed in chunks of this size through the worker's buffer.
+    They are never mapped: a writer truncating a mapped file under us
+    would turn the next page access into SIGBUS. */
+
+#define READ_CHUNK (1024 * 1024)
+
+#define INITIAL_BUCKETS 4096
+
+/* ---- XXH64 (https://github.com/Cyan4973/xxHash, xxh64 spec) ---- */
+
+#define P1 11400714785074694791ull
+#define P2 14029467366897019727ull
+#define P3 1609587929392839161ull
+#define P4 9650029242287828579ull
+#define P5 2870177450012600261ull
+
+static inline uint64_t
+rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t
+read64(const unsigned char *p)
+{
+    uint64_t v;
+
+    memcpy(&v, p, sizeof(v));       /* unaligned-safe, little-endian hosts */
+    return v;
+}
+
+static inline uint32_t
+read32(const unsigned char *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t
+xxh_round(uint64_t acc, uint64_t input)
+{
+    acc += input * P2;
+    acc = rotl64(acc, 31);
+    return acc * P1;
+}
+
+static inline uint64_t
+xxh_merge(uint64_t acc, uint64_t val)
+{
+    acc ^= xxh_round(0, val);
+    return acc * P1 + P4;
+}
+
+static inline void
+xxh_lanes_init(uint64_t v[4], uint64_t seed)
+{
+    v[0] = seed + P1 + P2;
+    v[1] = seed + P2;
+    v[2] = seed;
+    v[3] = seed - P1;
+}
+
+/* Feed every whole 32-byte stripe of [p, end) to the four independent
+    lanes. Returns where the unconsumed tail starts. */
+
+static const unsigned char *
+xxh_stripes(uint64_t v[4], const unsigned char *p, const unsigned char *end)
+{
+    for (; p + 32 <= end; p += 32) {
+        v[0] = xxh_round(v[0], read64(p));
+        v[1] = xxh_round(v[1], read64(p + 8));
+        v[2] = xxh_round(v[2], read64(p + 16));
+        v[3] = xxh_round(v[3], read64(p + 24));
+    }
+    return p;
+}
+
+static uint64_t
+xxh_converge(const uint64_t v[4])
+{
+    uint64_t h = rotl64(v[0], 1) + rotl64(v[1], 7) + rotl64(v[2], 12) +
+                 rotl64(v[3], 18);
+
+    h = xxh_merge(h, v[0]);
+    h = xxh_merge(h, v[1]);
+    h = xxh_merge(h, v[2]);
+    return xxh_merge(h, v[3]);
+}
+
+/* Mix in the last < 32 bytes and avalanche. */
+
+static uint64_t
+xxh_finish(uint64_t h, const unsigned char *p, const unsigned char *end)
+{
+    for (; p + 8 <= end; p += 8) {
+        h ^= xxh_round(0, read64(p));
+        h = rotl64(h, 27) * P1 + P4;
+    }
+    if (p + 4 <= end) {
+        h ^= (uint64_t) read32(p) * P1;
+        h = rotl64(h, 23) * P2 + P3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h ^= *p * P5;
+        h = rotl64(h, 11) * P1;
+    }
+
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t
+xxh64(const void *data, size_t len, uint64_t seed)
+{
+    const unsigned char *p = data;
+    const unsigned char *end = p + len;
+    uint64_t h;
+
+    if (len >= 32) {
+        uint64_t v[4];
+
+        xxh_lanes_init(v, seed);
+        p = xxh_stripes(v, p, end);
+        h = xxh_converge(v);
+    } else {
+        h = seed + P5;
+    }
+    return xxh_finish(h + len, p, end);
+}
+
+/* Streaming form, for files read a chunk at a time. Gives the same
+    result as xxh64() over the concatenated input. */
+
+struct xxh64_state {
+    uint64_t v[4];
+    uint64_t seed;
+    uint64_t total;
+    unsigned char mem[32];          /* partial stripe carried over */
+    size_t memsize;
+};
+
+static void
+xxh64_reset(struct xxh64_state *st, uint64_t seed)
+{
+    xxh_lanes_init(st->v, seed);
+    st->seed = seed;
+    st->total = 0;
+    st->memsize = 0;
+}
+
+static void
+xxh64_update(struct xxh64_state *st, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+    const unsigned char *end = p + len;
+
+    st->total += len;
+    if (st->memsize + len < 32) {
+        memcpy(st->mem + st->memsize, p, len);
+        st->memsize += len;
+        return;
+    }
+    if (st->memsize > 0) {
+        size_t fill = 32 - st->memsize;
+
+        memcpy(st->mem + st->memsize, p, fill);
+        xxh_stripes(st->v, st->mem, st->mem + 32);
+        p += fill;
+        st->memsize = 0;
+    }
+    p = xxh_stripes(st->v, p, end);
+    memcpy(st->mem, p, end - p);
+    st->memsize = end - p;
+}
+
+static uint64_t
+xxh64_digest(const struct xxh64_state *st)
+{
+    uint64_t h = st->total >= 32 ? xxh_converge(st->v) : st->seed + P5;
+
+    return xxh_finish(h + st->total, st->mem, st->mem + st->memsize);
+}
+
+/* ---- path table (callers hold ix->lock) ---- */
+
+static uint64_t
+hash_path(const char *s)
+{
+    return xxh64(s, strlen(s), 0);
+}
+
+static struct index_entry *
+lookup(struct indexer *ix, const char *path)
+{
+    struct index_entry *e = ix->buckets[hash_path(path) & (ix->n_buckets - 1)];
+
+    while (e != NULL && strcmp(e->path, path) != 0)
+        e = e->next;
+    return e;
+}
+
+static void
+grow(struct indexer *ix)
+{
+    size_t n = ix->n_buckets * 2;
+    struct index_entry **buckets = calloc(n, sizeof(*buckets));
+
+    if (buckets == NULL)
+        return;                     /* keep going with longer chains */
+    for (size_t b = 0; b < ix->n_buckets; b++) {
+        struct index_entry *e = ix->buckets[b];
+        while (e != NULL) {
+            struct index_entry *next = e->next;
+            size_t nb = hash_path(e->path) & (n - 1);
+            e->next = buckets[nb];
+            buckets[nb] = e;
+            e = next;
+        }
+    }
+    free(ix->buckets);
+    ix->buckets = buckets;
+    ix->n_buckets = n;
+}
+
+static void
+remove_entry(struct indexer *ix, struct index_entry *e)
+{
+    struct index_entry **pp = &ix->buckets[hash_path(e->path) & (ix->n_buckets - 1)];
+
+    while (*pp != e)
+        pp = &(*pp)->next;
+    *pp = e->next;
+    ix->count--;
+    free(e);
+}
+
+static void
+enqueue(struct indexer *ix, struct index_entry *e)
+{
+    e->queued = 1;
+    e->next_queued = NULL;
+    if (ix->queue_tail != NULL)
+        ix->queue_tail->next_queued = e;
+    else
+        ix->queue_head = e;
+    ix->queue_tail = e;
+    pthread_cond_signal(&ix->work);
+}
+
+static struct index_entry *
+lookup_or_add(struct indexer *ix, const char *path)
+{
+    struct index_entry *e = lookup(ix, path);
+    size_t b;
+
+    if (e != NULL)
+        return e;
+    if (ix->count >= ix->n_buckets)
+        grow(ix);
+    e = calloc(1, sizeof(*e) + strlen(path) + 1);
+    if (e == NULL)
+        return NULL;
+    strcpy(e->path, path);
+    b = hash_path(path) & (ix->n_buckets - 1);
+    e->next = ix->buckets[b];
+    ix->buckets[b] = e;
+    ix->count++;
+    return e;
+}
+
+/* ---- workers ---- */
+
+static int
+same_version(const struct stat *sb, off_t size, struct timespec mtime)
+{
+    return sb->st_size == size && sb->st_mtim.tv_sec == mtime.tv_sec &&
+           sb->st_mtim.tv_nsec == mtime.tv_nsec;
+}
+
+/* Hash the first 'size' bytes of an open file, READ_CHUNK at a time.
+    Returns 0 and sets *hash, 1 if the file ended early (it was
+    truncated while we read; try again later), or -1 on I/O error. */
+
+static int
+hash_fd(int fd, off_t size, char *buf, uint64_t *hash)
+{
+    struct xxh64_state st;
+    off_t off = 0;
+
+    xxh64_reset(&st, 0);
+    while (off < size) {
+        size_t want = size - off < READ_CHUNK ? (size_t) (size - off) : READ_CHUNK;
+        ssize_t got = pread(fd, buf, want, off);
+
+        if (got == -1 && errno == EINTR)
+            continue;
+        if (got == -1)
+            return -1;
+        if (got == 0)
+            return 1;
+        xxh64_update(&st, buf, got);
+        off += got;
+    }
+    *hash = xxh64_digest(&st);
+    return 0;
+}
+
+static void *
+worker(void *arg)
+{
+    struct indexer *ix = arg;
+    char *buf = malloc(READ_CHUNK);
+    char path[PATH_MAX];
+
+    if (buf == NULL)
+        return NULL;
+
+    pthread_mutex_lock(&ix->lock);
+    for (;;) {
+        struct index_entry *e;
+        struct stat sb, after;
+        uint64_t hash;
+        int fd, rc, gone;
+
+        while (ix->queue_head == NULL && !ix->stopping)
+            pthread_cond_wait(&ix->work, &ix->lock);
+        if ((e = ix->queue_head) == NULL)
+            break;                  /* stopping and drained */
+        ix->queue_head = e->next_queued;
+        if (ix->queue_head == NULL)
+            ix->queue_tail = NULL;
+        e->queued = 0;
+        e->busy = 1;
+        snprintf(path, sizeof(path), "%s", e->path);
+        pthread_mutex_unlock(&ix->lock);
+
+        /* While busy, e is ours: submit() marks it dirty instead of
+            queueing it, so no other worker hashes the same file and
+            nobody frees it. Its fields are only touched under the
+            lock. */
+
+        fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+        gone = fd == -1 && errno == ENOENT;
+        rc = -1;                    /* 0 hashed, 1 changed under us, 2 unchanged */
+        if (fd != -1 && fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode)) {
+            pthread_mutex_lock(&ix->lock);
+            int unchanged = e->hashed && same_version(&sb, e->size, e->mtime);
+            if (unchanged)
+                ix->unchanged++;
+            pthread_mutex_unlock(&ix->lock);
+
+            if (unchanged)
+                rc = 2;
+            else if ((rc = hash_fd(fd, sb.st_size, buf, &hash)) == 0 &&
+                     (fstat(fd, &after) != 0 ||
+                      !same_version(&after, sb.st_size, sb.st_mtim)))
+                rc = 1;             /* written to while we read it */
+        }
+        if (fd != -1)
+            close(fd);
+
+        pthread_mutex_lock(&ix->lock);
+        e->busy = 0;
+        if (rc == 0) {
+            e->size = sb.st_size;
+            e->mtime = sb.st_mtim;
+            e->hash = hash;
+            e->hashed = 1;
+            ix->hashed++;
+            ix->bytes += sb.st_size;
+        } else if (rc == 1) {
+            /* Keep the old entry: the writer's own IN_CLOSE_WRITE has
+                already marked it dirty or will resubmit it. */
+        } else if (rc == -1 && gone && !e->dirty) {
+            remove_entry(ix, e);    /* deleted: forget it */
+            continue;
+        } else if (rc == -1) {
+            ix->errors++;           /* not a regular file, or unreadable */
+        }
+        if (e->dirty) {
+            e->dirty = 0;
+            enqueue(ix, e);
+        }
+    }
+    pthread_mutex_unlock(&ix->lock);
+    free(buf);
+    return NULL;
+}
+
+/* ---- on-disk index ---- */
+
+static int
+load(struct indexer *ix)
+{
+    FILE *f = fopen(ix->index_path, "r");
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+
+    if (f == NULL)
+        return errno == ENOENT ? 0 : -1;
+
+    while ((len = getline(&line, &cap, f)) > 0) {
+        uint64_t hash;
+        long long size, sec;
+        long nsec;
+        int off = 0;
+        struct index_entry *e;
+
+        if (line[len - 1] == '\n')
+            line[len - 1] = '\0';
+        if (sscanf(line, "%" SCNx64 " %lld %lld.%ld %n", &hash, &size, &sec,
+                   &nsec, &off) != 4 || off == 0 || line[off] == '\0')
+            continue;               /* skip malformed lines */
+        if ((e = lookup_or_add(ix, line + off)) == NULL)
+            break;
+        e->hash = hash;
+        e->size = size;
+        e->mtime.tv_sec = sec;
+        e->mtime.tv_nsec = nsec;
+        e->hashed = 1;
+    }
+    free(line);
+    fclose(f);
+    return 0;
+}
+
+static int
+save(struct indexer *ix)
+{
+    char tmp[PATH_MAX];
+    FILE *f;
+
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", ix->index_path) >= (int) sizeof(tmp))
+        return -1;
+    if ((f = fopen(tmp, "w")) == NULL)
+        return -1;
+
+    for (size_t b = 0; b < ix->n_buckets; b++) {
+        for (struct index_entry *e = ix->buckets[b]; e != NULL; e = e->next) {
+            if (!e->hashed || strchr(e->path, '\n') != NULL)
+                continue;
+            fprintf(f, "%016" PRIx64 " %lld %lld.%09ld %s\n", e->hash,
+                    (long long) e->size, (long long) e->mtime.tv_sec,
+                    e->mtime.tv_nsec, e->path);
+        }
+    }
+
+    if (fflush(f) != 0 || fsync(fileno(f)) != 0) {
+        fclose(f);
+        unlink(tmp);
+        return -1;
+    }
+    fclose(f);
+    return rename(tmp, ix->index_path);
+}
+
+/* ---- public API ---- */
+
+int
+indexer_open(struct indexer *ix, const char *index_path, int n_workers)
+{
+    memset(ix, 0, sizeof(*ix));
+    ix->index_path = index_path;
+    ix->n_buckets = INITIAL_BUCKETS;
+    ix->buckets = calloc(ix->n_buckets, sizeof(*ix->buckets));
+    ix->workers = calloc(n_workers, sizeof(pthread_t));
+    if (ix->buckets == NULL || ix->workers == NULL)
+        return -1;
+    pthread_mutex_init(&ix->lock, NULL);
+    pthread_cond_init(&ix->work, NULL);
+
+    if (load(ix) == -1)
+        return -1;
+
+    for (; ix->n_workers < n_workers; ix->n_workers++) {
+        errno = pthread_create(&ix->workers[ix->n_workers], NULL, worker, ix);
+        if (errno != 0)
+            return ix->n_workers > 0 ? 0 : -1;
+    }
+    return 0;
+}
+
+void
+indexer_submit(struct indexer *ix, const char *path)
+{
+    struct index_entry *e;
+
+    pthread_mutex_lock(&ix->lock);
+    e = lookup_or_add(ix, path);
+    if (e != NULL && e->busy)
+        e->dirty = 1;               /* its worker queues it again when done */
+    else if (e != NULL && !e->queued)
+        enqueue(ix, e);
+    pthread_mutex_unlock(&ix->lock);
+}
+
+int
+indexer_close(struct indexer *ix)
+{
+    int rc;
+
+    pthread_mutex_lock(&ix->lock);
+    ix->stopping = 1;
+    pthread_cond_broadcast(&ix->work);
+    pthread_mutex_unlock(&ix->lock);
+
+    for (int i = 0; i < ix->n_workers; i++)
+        pthread_join(ix->workers[i], NULL);
+
+    rc = save(ix);
+
+    for (size_t b = 0; b < ix->n_buckets; b++) {
+        struct index_entry *e = ix->buckets[b];
+        while (e != NULL) {
+            struct index_entry *next = e->next;
+            free(e);
+            e = next;
+        }
+    }
+    free(ix->buckets);
+    free(ix->workers);
+    pthread_mutex_destroy(&ix->lock);
+    pthread_cond_destroy(&ix->work);
+    return rc;
+}
@@ -0,0 +1,69 @@
+#ifndef INDEXER_H
+#define INDEXER_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+
+/* Incremental content indexer. Paths of files that were closed after
+    a write are submitted from the event loop; a pool of worker threads
+    hashes them (XXH64, read in chunks) and records
+    path -> (size, mtime, hash). A file whose size and mtime still match
+    its index entry is never read again, so keeping a large tree's
+    checksums current costs work proportional to what changed.
+
+    The index is a text file, one "hash size mtime path" line per file,
+    loaded on open and rewritten atomically (temp file + rename) on
+    close. */
+
+struct index_entry {
+    struct index_entry *next;       /* hash bucket chain */
+    struct index_entry *next_queued;
+    off_t size;
+    struct timespec mtime;
+    uint64_t hash;
+    int hashed;                     /* size/mtime/hash are valid */
+    int queued;                     /* already waiting for a worker */
+    int busy;                       /* a worker is hashing it right now */
+    int dirty;                      /* submitted again while busy */
+    char path[];
+};
+
+struct indexer {
+    const char *index_path;
+
+    pthread_mutex_t lock;           /* protects everything below */
+    pthread_cond_t work;
+    struct index_entry **buckets;
+    size_t n_buckets;               /* power of two */
+    size_t count;
+    struct index_entry *queue_head, *queue_tail;
+    int stopping;
+
+    pthread_t *workers;
+    int n_workers;
+
+    unsigned long hashed, unchanged, errors;
+    unsigned long long bytes;
+};
+
+/* Load index_path (missing is fine: start empty) and start n_workers
+    hashing threads. Returns 0, or -1 with errno set. */
+int indexer_open(struct indexer *ix, const char *index_path, int n_workers);
+
+/* Queue 'path' for (re)hashing. Cheap and non-blocking apart from the
+    index lock; a path that is already queued is not queued twice, and
+    one being hashed is queued again once its worker is done. A file
+    found deleted is dropped from the index. */
+void indexer_submit(struct indexer *ix, const char *path);
+
+/* Finish the queued work, stop the workers and write the index back.
+    Returns 0, or -1 if the index could not be saved. */
+int indexer_close(struct indexer *ix);
+
+/* XXH64 of a buffer. */
+uint64_t xxh64(const void *data, size_t len, uint64_t seed);
+
+#endif
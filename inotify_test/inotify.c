@@ -1,30 +1,475 @@
+#include <dirent.h>
 #include <errno.h>
+#include <limits.h>
 #include <poll.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/inotify.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <string.h>
+#include <time.h>
+#include "coalesce.h"
+#include "dispatch.h"
+#include "eventlog.h"
+#include "fanotify_backend.h"
+#include "indexer.h"
+#include "snapshot.h"
+#include "trace.h"
+#include "watch_table.h"
 
-/* Read all available inotify events from the file descriptor 'fd'.
-    wd is the table of watch descriptors for the directories in argv.
-    argc is the length of wd and argv.
-    argv is the list of watched directories.
-    Entry 0 of wd and argv is unused. */
+/* Default size of the buffer each read() drains the kernel queue into.
+    Every read is a syscall, so a bigger buffer means fewer of them when
+    a build or rsync is producing events by the million. */
+
+#define DEFAULT_READ_BUF (256 * 1024)
+
+/* Smallest buffer that is guaranteed to hold one event. */
+
+#define MIN_READ_BUF (sizeof(struct inotify_event) + NAME_MAX + 1)
+
+/* Default coalescing window: events for the same path within this many
+    milliseconds are merged into one change record. */
+
+#define DEFAULT_WINDOW_MS 100
+
+/* Set by SIGUSR1: print the dispatch workers' counters. */
+
+static volatile sig_atomic_t stats_requested;
 
 static void
-handle_events(int fd, int *wd, int argc, char* argv[])
+on_sigusr1(int sig)
+{
+    (void) sig;
+    stats_requested = 1;
+}
+
+/* Events reported for every watched path. */
+
+#define WATCH_MASK (IN_OPEN | IN_CLOSE)
+
+/* Extra events needed on directories in recursive mode, so that new
+    subdirectories (created or moved in) can be watched as they appear,
+    and ones moved away or deleted stop resolving to their old paths. */
+
+#define TREE_MASK (WATCH_MASK | IN_CREATE | IN_MOVED_TO | IN_MOVED_FROM | \
+                   IN_DELETE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW)
+
+/* Everything the event loop needs, so it can be passed around as one. */
+
+struct watcher {
+    int fd;                         /* inotify instance */
+    int use_fanotify;               /* fan is the event source instead */
+    struct fan_backend fan;
+    int recursive;
+    struct watch_table watches;     /* wd -> path */
+    char *buf;                      /* read buffer, aligned for inotify_event */
+    size_t buf_size;
+    struct coalescer coalescer;     /* merges events until the window closes */
+    int overflowed;                 /* IN_Q_OVERFLOW seen (or a dispatch
+                                       queue was full), rescan pending */
+    unsigned long overflows;
+    int indexing;                   /* -i: hash files closed after writing */
+    struct indexer indexer;
+    int logging;                    /* -l: records go to the log, not stdout */
+    struct eventlog log;
+    int dispatching;                /* events go to worker threads */
+    struct dispatcher dispatcher;
+};
+
+static long
+now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+/* Add a watch for 'path' and record wd -> path in 'watches', along
+    with the directory's inode and mtime for later rescans.
+    Returns the watch descriptor, or -1 (with a message on stderr). */
+
+static int
+add_watch(int fd, struct watch_table *watches, const char *path,
+          uint32_t mask)
+{
+    struct watch_entry *entry;
+    struct stat sb;
+    int wd = inotify_add_watch(fd, path, mask);
+
+    if (wd == -1) {
+        fprintf(stderr, "Cannot watch '%s': %s\n", path, strerror(errno));
+        if (errno == ENOSPC)
+            fprintf(stderr, "Raise /proc/sys/fs/inotify/max_user_watches "
+                    "to watch more directories.\n");
+        return -1;
+    }
+    if ((entry = watch_table_put(watches, wd, path)) == NULL) {
+        perror("watch_table_put");
+        exit(EXIT_FAILURE);
+    }
+    if (lstat(path, &sb) == 0) {
+        entry->ino = sb.st_ino;
+        entry->mtime = sb.st_mtim;
+    }
+    return wd;
+}
+
+/* Watch 'root' and every directory below it. The walk is iterative
+    (an explicit stack of paths) so deep trees cannot overflow the call
+    stack, and it trusts d_type to avoid a stat() per entry, falling
+    back to lstat() only on filesystems that report DT_UNKNOWN.
+    Symlinks are not followed. Returns the number of watches added. */
+
+static size_t
+add_tree(int fd, struct watch_table *watches, const char *root)
+{
+    char **stack = NULL;
+    size_t depth = 0, cap = 0, added = 0;
+    char child[PATH_MAX];
+
+    stack = malloc(sizeof(char *) * (cap = 64));
+    if (stack == NULL || (stack[depth] = strdup(root)) == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    depth++;
+
+    while (depth > 0) {
+        char *dir = stack[--depth];
+        DIR *d;
+        struct dirent *ent;
+
+        if (add_watch(fd, watches, dir, TREE_MASK) == -1 ||
+                (d = opendir(dir)) == NULL) {
+            free(dir);
+            continue;
+        }
+        added++;
+
+        while ((ent = readdir(d)) != NULL) {
+            struct stat sb;
+            int is_dir;
+
+            if (strcmp(ent->d_name, ".") == 0 ||
+                    strcmp(ent->d_name, "..") == 0)
+                continue;
+            if (snprintf(child, sizeof(child), "%s/%s", dir, ent->d_name)
+                    >= (int) sizeof(child))
+                continue;
+
+            if (ent->d_type == DT_UNKNOWN)
+                is_dir = lstat(child, &sb) == 0 && S_ISDIR(sb.st_mode);
+            else
+                is_dir = ent->d_type == DT_DIR;
+            if (!is_dir)
+                continue;
+
+            if (depth == cap) {
+                char **grown = realloc(stack, sizeof(char *) * (cap *= 2));
+                if (grown == NULL) {
+                    perror("realloc");
+                    exit(EXIT_FAILURE);
+                }
+                stack = grown;
+            }
+            if ((stack[depth] = strdup(child)) == NULL) {
+                perror("strdup");
+                exit(EXIT_FAILURE);
+            }
+            depth++;
+        }
+        closedir(d);
+        free(dir);
+    }
+
+    free(stack);
+    return added;
+}
+
+/* Recover from IN_Q_OVERFLOW. The kernel threw events away, so we no
+    longer know what changed, but rescanning every watched directory in
+    full would be as slow as starting over. Instead compare each watched
+    directory's inode and mtime with what we saw last: only directories
+    whose entries changed get a RESCAN record (and, in recursive mode,
+    a look for subdirectories that appeared while events were lost).
+    File content changes in otherwise untouched directories do not move
+    the directory mtime and cannot be recovered this way. */
+
+static void
+rescan_after_overflow(struct watcher *w)
+{
+    char **changed = NULL;
+    size_t n_changed = 0;
+    struct stat sb;
+    char child[PATH_MAX];
+    long now = now_ms();
+
+    /* Collect first: adding watches below may resize the table. */
+
+    changed = malloc(sizeof(char *) * (w->watches.count + 1));
+    if (changed == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < w->watches.capacity; i++) {
+        struct watch_entry *e = &w->watches.slots[i];
+
+        if (e->wd == 0 || lstat(e->path, &sb) == -1)
+            continue;
+        if (sb.st_ino == e->ino && sb.st_mtim.tv_sec == e->mtime.tv_sec &&
+                sb.st_mtim.tv_nsec == e->mtime.tv_nsec)
+            continue;
+        e->ino = sb.st_ino;
+        e->mtime = sb.st_mtim;
+        if ((changed[n_changed] = strdup(e->path)) != NULL)
+            n_changed++;
+    }
+
+    for (size_t i = 0; i < n_changed; i++) {
+        DIR *d;
+        struct dirent *ent;
+
+        coalescer_add(&w->coalescer, changed[i], NULL,
+                      IN_Q_OVERFLOW | IN_ISDIR, now);
+
+        if (w->recursive && (d = opendir(changed[i])) != NULL) {
+            while ((ent = readdir(d)) != NULL) {
+                int wd;
+
+                if (strcmp(ent->d_name, ".") == 0 ||
+                        strcmp(ent->d_name, "..") == 0)
+                    continue;
+                if (ent->d_type != DT_DIR && ent->d_type != DT_UNKNOWN)
+                    continue;
+                if (snprintf(child, sizeof(child), "%s/%s", changed[i],
+                             ent->d_name) >= (int) sizeof(child))
+                    continue;
+
+                /* IN_MASK_CREATE fails with EEXIST on directories we
+                    already watch, so only genuinely new ones get walked. */
+
+                wd = inotify_add_watch(w->fd, child, TREE_MASK | IN_MASK_CREATE);
+                if (wd == -1)
+                    continue;
+                add_tree(w->fd, &w->watches, child);
+                coalescer_add(&w->coalescer, child, NULL,
+                              IN_CREATE | IN_ISDIR, now);
+            }
+            closedir(d);
+        }
+        free(changed[i]);
+    }
+    free(changed);
+    w->overflowed = 0;
+}
+
+/* Warm start: instead of walking every tree from scratch, diff the
+    snapshot saved at the last shutdown against the filesystem (in
+    parallel, reading only directories whose mtime moved), register
+    watches for the directories that exist now, and queue what changed
+    while we were down: IN_CREATE / IN_DELETE for directories that
+    appeared or vanished, IN_MODIFY for directories whose entries
+    changed. Returns 0, or -1 if there is no usable snapshot and the
+    caller should do a cold start. */
+
+static int
+warm_start(struct watcher *w, const char *snapshot_path, char *const roots[],
+           int n_roots, int n_threads)
+{
+    static const uint32_t change_mask[] = {
+        [SNAPSHOT_ADDED] = IN_CREATE | IN_ISDIR,
+        [SNAPSHOT_REMOVED] = IN_DELETE | IN_ISDIR,
+        [SNAPSHOT_CHANGED] = IN_MODIFY | IN_ISDIR,
+    };
+    struct snapshot snap;
+    struct snapshot_diff diff;
+    long start = now_ms(), now;
+
+    if (snapshot_load(&snap, snapshot_path) == -1) {
+        if (errno != ENOENT)
+            fprintf(stderr, "Ignoring snapshot '%s': %s\n", snapshot_path,
+                    strerror(errno));
+        return -1;
+    }
+    if (snapshot_diff(&snap, roots, n_roots, n_threads, &diff) == -1) {
+        snapshot_unload(&snap);
+        return -1;
+    }
+
+    for (size_t i = 0; i < diff.n_live; i++)
+        add_watch(w->fd, &w->watches, diff.live[i], TREE_MASK);
+
+    now = now_ms();
+    for (size_t i = 0; i < diff.n_changes; i++)
+        coalescer_add(&w->coalescer, diff.changes[i].path, NULL,
+                      change_mask[diff.changes[i].kind], now);
+
+    printf("Warm start: %zu directories (%zu read, %zu loaded from snapshot), "
+           "%zu changed while stopped, %ld ms\n", diff.n_live, diff.read_dirs,
+           diff.n_live - diff.read_dirs, diff.n_changes, now - start);
+
+    snapshot_diff_free(&diff);
+    snapshot_unload(&snap);
+    return 0;
+}
+
+/* Persist the watched directory list for the next warm start. */
+
+static void
+save_snapshot(struct watcher *w, const char *snapshot_path)
+{
+    char **paths = malloc((w->watches.count + 1) * sizeof(char *));
+    size_t n = 0;
+
+    if (paths == NULL) {
+        perror("malloc");
+        return;
+    }
+    for (size_t i = 0; i < w->watches.capacity; i++)
+        if (w->watches.slots[i].wd != 0)
+            paths[n++] = w->watches.slots[i].path;
+    if (snapshot_save(snapshot_path, paths, n) == -1)
+        fprintf(stderr, "Cannot save snapshot '%s': %s\n", snapshot_path,
+                strerror(errno));
+    else
+        printf("Saved snapshot of %zu directories to %s\n", n, snapshot_path);
+    free(paths);
+}
+
+/* Coalescer sink: one line per changed path, e.g.
+        IN_OPEN|IN_CLOSE_WRITE: /src/main.o [file] x12
+    stdout is fully buffered, so a whole flush goes out in few writes.
+    Dispatch workers print concurrently; the lock keeps lines whole. */
+
+static void
+print_change(const struct change_record *rec, void *arg)
+{
+    char names[MASK_NAMES_MAX];
+
+    (void) arg;
+    format_mask(rec->mask, names, sizeof(names));
+    flockfile(stdout);
+    printf("%s: %s %s", names, rec->path,
+           (rec->mask & IN_ISDIR) ? "[directory]" : "[file]");
+    if (rec->count > 1)
+        printf(" x%u", rec->count);
+    putchar('\n');
+    funlockfile(stdout);
+}
+
+/* Coalescer sink: print the record (or append it to the event log),
+    and in indexer mode queue files that were written for hashing.
+    Doing this after coalescing means a file rewritten many times within
+    a window is hashed once. Called from the dispatch workers as well as
+    the main thread; the event log and the indexer are thread-safe. */
+
+static void
+emit_change(const struct change_record *rec, void *arg)
+{
+    struct watcher *w = arg;
+
+    if (w->logging)
+        eventlog_append(&w->log, rec->path, rec->mask, rec->count);
+    else
+        print_change(rec, NULL);
+    if (w->indexing && (rec->mask & IN_CLOSE_WRITE) && !(rec->mask & IN_ISDIR))
+        indexer_submit(&w->indexer, rec->path);
+}
+
+static void
+flush_coalescer(struct coalescer *c, void *arg)
+{
+    TRACE_BEGIN("flush");
+    coalescer_flush(c, emit_change, arg);
+    fflush(stdout);
+    TRACE_END("flush");
+}
+
+static void
+flush_changes(struct watcher *w)
+{
+    flush_coalescer(&w->coalescer, w);
+}
+
+/* One line per dispatch worker. Also used while the workers run, so
+    the lines are written under the stdout lock they print with. */
+
+static void
+print_dispatch_stats(struct watcher *w)
+{
+    flockfile(stdout);
+    for (int i = 0; i < w->dispatcher.n_shards; i++) {
+        struct dispatch_stats st;
+
+        dispatcher_stats(&w->dispatcher, i, &st);
+        printf("Worker %d: %lu events, queue depth %lu (max %lu), %lu dropped\n",
+               i, st.processed, st.depth, st.max_depth, st.dropped);
+    }
+    fflush(stdout);
+    funlockfile(stdout);
+}
+
+/* A directory was moved away from 'root': stop watching it and
+    everything below it, so later events cannot resolve to paths that no
+    longer exist. If it was only renamed within the tree, the matching
+    IN_MOVED_TO watches it again under its new path. */
+
+static void
+drop_tree(struct watcher *w, const char *root)
+{
+    size_t len = strlen(root), n = 0;
+    int *wds;
+
+    /* Collect first: removing entries shifts the table around. */
+
+    wds = malloc(sizeof(int) * (w->watches.count + 1));
+    if (wds == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < w->watches.capacity; i++) {
+        const struct watch_entry *e = &w->watches.slots[i];
+
+        if (e->wd != 0 && strncmp(e->path, root, len) == 0 &&
+                (e->path[len] == '\0' || e->path[len] == '/'))
+            wds[n++] = e->wd;
+    }
+    for (size_t i = 0; i < n; i++) {
+        inotify_rm_watch(w->fd, wds[i]);
+        watch_table_remove(&w->watches, wds[i]);
+    }
+    free(wds);
+}
+
+/* Read all available inotify events from the watcher's descriptor.
+    w->watches maps each watch descriptor back to its path.
+    w->recursive is set when whole trees are being watched, in which
+    case new subdirectories are added to the watch set as they appear.
+    Events are handed to the dispatch workers (or, without them, to the
+    coalescer); nothing is printed here. */
+
+static void
+handle_events(struct watcher *w)
 {
     /* Some systems cannot read integer variables if they are not
         properly aligned. On other systems, incorrect alignment may
         decrease performance. Hence, the buffer used for reading from
-        the inotify file descriptor should have the same alignment as
+        the inotify file descriptor (w->buf) has the same alignment as
         struct inotify_event. */
 
-    char buf[4096]
-        __attribute__ ((aligned(__alignof__(struct inotify_event))));
     const struct inotify_event *event;
     ssize_t len;
+    long now;
+
+    if (w->use_fanotify) {
+        TRACE_BEGIN("fanotify_read");
+        fan_backend_read(&w->fan, w->buf, w->buf_size, &w->coalescer, now_ms());
+        TRACE_END("fanotify_read");
+        return;
+    }
 
     /* Loop while events can be read from inotify file descriptor. */
 
@@ -32,7 +477,9 @@ handle_events(int fd, int *wd, int argc, char* argv[])
 
         /* Read some events. */
 
-        len = read(fd, buf, sizeof(buf));
+        TRACE_BEGIN("read");
+        len = read(w->fd, w->buf, w->buf_size);
+        TRACE_END("read");
         if (len == -1 && errno != EAGAIN) {
             perror("read");
             exit(EXIT_FAILURE);
@@ -45,90 +492,287 @@ handle_events(int fd, int *wd, int argc, char* argv[])
         if (len <= 0)
             break;
 
+        TRACE_COUNTER("read_bytes", len);
+        TRACE_BEGIN("parse");
+        now = now_ms();
+
         /* Loop over all events in the buffer. */
 
-        for (char *ptr = buf; ptr < buf + len;
+        for (char *ptr = w->buf; ptr < w->buf + len;
                 ptr += sizeof(struct inotify_event) + event->len) {
 
             event = (const struct inotify_event *) ptr;
 
-            /* Print event type. */
+            /* The kernel dropped events because its queue filled up.
+                Finish draining, then rescan what may have been missed. */
 
-            if (event->mask & IN_OPEN)
-                printf("IN_OPEN: ");
-            if (event->mask & IN_CLOSE_NOWRITE)
-                printf("IN_CLOSE_NOWRITE: ");
-            if (event->mask & IN_CLOSE_WRITE)
-                printf("IN_CLOSE_WRITE: ");
+            if (event->mask & IN_Q_OVERFLOW) {
+                w->overflowed = 1;
+                w->overflows++;
+                continue;
+            }
 
-            /* Print the name of the watched directory. */
+            /* The watch is gone (directory deleted, filesystem
+                unmounted, or watch removed): forget its wd. */
 
-            for (size_t i = 1; i < argc; ++i) {
-                if (wd[i] == event->wd) {
-                    printf("%s/", argv[i]);
-                    break;
-                }
+            if (event->mask & (IN_IGNORED | IN_DELETE_SELF)) {
+                watch_table_remove(&w->watches, event->wd);
+                continue;
             }
 
-            /* Print the name of the file. */
+            const char *dir = watch_table_get(&w->watches, event->wd);
+            if (dir == NULL)
+                continue;
 
-            if (event->len)
-                printf("%s", event->name);
+            /* A directory appeared below a watched tree: watch it and
+                everything already inside it. One renamed within the tree
+                lost its watches at IN_MOVED_FROM and is watched afresh. */
 
-            /* Print type of filesystem object. */
+            if (w->recursive && (event->mask & IN_ISDIR) &&
+                    (event->mask & (IN_CREATE | IN_MOVED_TO)) && event->len) {
+                char path[PATH_MAX];
 
-            if (event->mask & IN_ISDIR)
-                printf(" [directory]\n");
-            else
-                printf(" [file]\n");
+                if (snprintf(path, sizeof(path), "%s/%s", dir,
+                             event->name) < (int) sizeof(path))
+                    add_tree(w->fd, &w->watches, path);
+
+                /* add_tree may have resized the table under 'dir'. */
+
+                if ((dir = watch_table_get(&w->watches, event->wd)) == NULL)
+                    continue;
+            }
+
+            /* A directory left (or was renamed within) the tree: its
+                watches would keep reporting under the old path. */
+
+            if (w->recursive && (event->mask & IN_ISDIR) &&
+                    (event->mask & IN_MOVED_FROM) && event->len) {
+                char path[PATH_MAX];
+
+                if (snprintf(path, sizeof(path), "%s/%s", dir,
+                             event->name) < (int) sizeof(path))
+                    drop_tree(w, path);
+                if ((dir = watch_table_get(&w->watches, event->wd)) == NULL)
+                    continue;
+            }
+
+            /* Hand the event to its directory's worker, or merge it
+                into the change record for this path right here. A full
+                worker queue loses the event, so rescan as if the kernel
+                queue had overflowed. */
+
+            if (w->dispatching) {
+                if (dispatcher_push(&w->dispatcher, event->wd, dir,
+                                    event->len ? event->name : NULL,
+                                    event->mask, now) == -1)
+                    w->overflowed = 1;
+            } else {
+                coalescer_add(&w->coalescer, dir, event->len ? event->name : NULL,
+                              event->mask, now);
+            }
         }
+        TRACE_END("parse");
     }
+
+    if (w->overflowed)
+        rescan_after_overflow(w);
 }
 
 int
 main(int argc, char* argv[])
 {
     char buf;
-    int fd, i, poll_num;
-    int *wd;
+    int i, opt, poll_num;
+    long window_ms = DEFAULT_WINDOW_MS;
+    const char *index_path = NULL;
+    const char *snapshot_path = NULL;
+    const char *log_dir = NULL;
+    long n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    long n_dispatch = 0;
+    struct watcher w;
     nfds_t nfds;
     struct pollfd fds[2];
 
-    if (argc < 2) {
-        printf("Usage: %s PATH [PATH ...]\n", argv[0]);
+    memset(&w, 0, sizeof(w));
+    w.buf_size = DEFAULT_READ_BUF;
+
+    while ((opt = getopt(argc, argv, "frb:w:i:j:s:l:t:")) != -1) {
+        switch (opt) {
+        case 'f':
+            w.use_fanotify = 1;
+            break;
+        case 'r':
+            w.recursive = 1;
+            break;
+        case 'b':
+            w.buf_size = strtoul(optarg, NULL, 0);
+            if (w.buf_size < MIN_READ_BUF)
+                w.buf_size = MIN_READ_BUF;
+            break;
+        case 'w':
+            window_ms = atol(optarg);
+            if (window_ms < 0)
+                window_ms = 0;
+            break;
+        case 'i':
+            index_path = optarg;
+            break;
+        case 'j':
+            n_threads = atol(optarg);
+            break;
+        case 's':
+            snapshot_path = optarg;
+            w.recursive = 1;
+            break;
+        case 'l':
+            log_dir = optarg;
+            break;
+        case 't':
+            n_dispatch = atol(optarg);
+            break;
+        default:
+            optind = argc + 1;      /* force the usage message */
+            break;
+        }
+    }
+
+    if (optind >= argc) {
+        printf("Usage: %s [-f] [-r] [-b BYTES] [-w MS] PATH [PATH ...]\n", argv[0]);
+        printf("  -f  use fanotify: one mark per filesystem, everything below each PATH\n");
+        printf("      (falls back to inotify when fanotify is unavailable)\n");
+        printf("  -r  watch each PATH recursively, including new subdirectories\n");
+        printf("  -b  read buffer size (default %d)\n", DEFAULT_READ_BUF);
+        printf("  -w  coalescing window in milliseconds (default %d)\n",
+               DEFAULT_WINDOW_MS);
+        printf("  -i  keep INDEX (path -> size, mtime, hash) current for every\n"
+               "      file closed after writing\n");
+        printf("  -j  threads for -i hashing and -s diffing (default: one per CPU)\n");
+        printf("  -s  save the watched tree to SNAPSHOT on exit and warm start\n"
+               "      from it, reporting what changed while stopped (implies -r)\n");
+        printf("  -l  append change records to the memory-mapped log in LOGDIR\n"
+               "      instead of printing them (read it with logtail)\n");
+        printf("  -t  worker threads that process events, sharded by directory\n"
+               "      (default 0: all on the reading thread); changes in different\n"
+               "      directories may then be reported out of order, and SIGUSR1\n"
+               "      prints the workers' queue depths and drops\n");
         exit(EXIT_FAILURE);
     }
 
+    /* Change records are written in batches; flush_changes() flushes. */
+
+    setvbuf(stdout, NULL, _IOFBF, 64 * 1024);
+    TRACE_THREAD_NAME("watcher");
+
+    if (log_dir != NULL) {
+        if (eventlog_create(&w.log, log_dir, EVENTLOG_DEFAULT_SEGMENTS,
+                            EVENTLOG_DEFAULT_RECORDS) == -1) {
+            fprintf(stderr, "Cannot open event log '%s': %s\n", log_dir,
+                    strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        w.logging = 1;
+    }
+
     printf("Press ENTER key to terminate.\n");
 
+    /* Try fanotify first if asked to. It needs CAP_SYS_ADMIN and a
+        kernel with FAN_REPORT_DFID_NAME (5.9+); otherwise fall back to
+        inotify, which is always recursive when standing in for -f. */
+
+    if (w.use_fanotify) {
+        if (fan_backend_open(&w.fan, argv + optind, argc - optind) == 0) {
+            printf("Watching %zu filesystem(s) with fanotify%s\n",
+                   w.fan.n_mounts, w.fan.whole_fs ? "" :
+                   " (mount marks: open/close only)");
+        } else {
+            printf("fanotify unavailable (%s); falling back to inotify\n",
+                   strerror(errno));
+            w.use_fanotify = 0;
+            w.recursive = 1;
+        }
+    }
+
     /* Create the file descriptor for accessing the inotify API. */
 
-    fd = inotify_init1(IN_NONBLOCK);
-    if (fd == -1) {
+    w.fd = inotify_init1(IN_NONBLOCK);
+    if (w.fd == -1) {
         perror("inotify_init1");
         exit(EXIT_FAILURE);
     }
 
-    /* Allocate memory for watch descriptors. */
+    /* Allocate the wd -> path table, the read buffer and the coalescer. */
 
-    wd = calloc(argc, sizeof(int));
-    if (wd == NULL) {
-        perror("calloc");
+    if (watch_table_init(&w.watches, argc) == -1) {
+        perror("watch_table_init");
+        exit(EXIT_FAILURE);
+    }
+    w.buf_size = (w.buf_size + __alignof__(struct inotify_event) - 1) &
+                 ~(__alignof__(struct inotify_event) - 1);
+    w.buf = aligned_alloc(__alignof__(struct inotify_event), w.buf_size);
+    if (w.buf == NULL) {
+        perror("aligned_alloc");
+        exit(EXIT_FAILURE);
+    }
+    if (coalescer_init(&w.coalescer, window_ms) == -1) {
+        perror("coalescer_init");
         exit(EXIT_FAILURE);
     }
+    if (n_threads < 1)
+        n_threads = 1;
+    if (index_path != NULL) {
+        if (indexer_open(&w.indexer, index_path, n_threads) == -1) {
+            fprintf(stderr, "Cannot open index '%s': %s\n", index_path,
+                    strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        w.indexing = 1;
+    }
 
     /* Mark directories for events
         - file was opened
-        - file was closed */
-
-    for (i = 1; i < argc; i++) {
-        wd[i] = inotify_add_watch(fd, argv[i],
-                                    IN_OPEN | IN_CLOSE);
-        if (wd[i] == -1) {
-            fprintf(stderr, "Cannot watch '%s': %s\n",
-                    argv[i], strerror(errno));
+        - file was closed
+        In recursive mode every directory below each PATH is marked too,
+        from the snapshot when there is one. */
+
+    if (snapshot_path != NULL && w.use_fanotify) {
+        printf("Snapshots need per-directory watches; ignoring -s with fanotify\n");
+        snapshot_path = NULL;
+    }
+    if (snapshot_path != NULL &&
+            warm_start(&w, snapshot_path, argv + optind, argc - optind,
+                       n_threads) == 0)
+        i = argc;                   /* watches are in place */
+    else
+        i = optind;
+
+    for (; i < argc && !w.use_fanotify; i++) {
+        if (w.recursive) {
+            size_t added = add_tree(w.fd, &w.watches, argv[i]);
+            if (added == 0)
+                exit(EXIT_FAILURE);
+            printf("Watching %zu directories under %s\n", added, argv[i]);
+        } else if (add_watch(w.fd, &w.watches, argv[i], WATCH_MASK) == -1) {
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    /* Start the workers. fanotify events go through its own reader
+        into the main coalescer, so they are only used with inotify. */
+
+    if (n_dispatch > 0 && !w.use_fanotify) {
+        if (dispatcher_start(&w.dispatcher, n_dispatch, window_ms,
+                             flush_coalescer, &w) == -1) {
+            perror("dispatcher_start");
             exit(EXIT_FAILURE);
         }
+        w.dispatching = 1;
+
+        /* kill -USR1 shows queue depths and drops while running. No
+            SA_RESTART, so poll() returns and the loop prints them. */
+
+        struct sigaction sa = { .sa_handler = on_sigusr1 };
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGUSR1, &sa, NULL);
     }
 
     /* Prepare for polling. */
@@ -138,14 +782,23 @@ main(int argc, char* argv[])
     fds[0].fd = STDIN_FILENO;       /* Console input */
     fds[0].events = POLLIN;
 
-    fds[1].fd = fd;                 /* Inotify input */
+    fds[1].fd = w.use_fanotify ? w.fan.fd : w.fd;   /* Inotify input */
     fds[1].events = POLLIN;
 
     /* Wait for events and/or terminal input. */
 
     printf("Listening for events.\n");
+    fflush(stdout);
     while (1) {
-        poll_num = poll(fds, nfds, -1);
+
+        if (stats_requested) {
+            stats_requested = 0;
+            print_dispatch_stats(&w);
+        }
+
+        /* Sleep until input arrives or the coalescing window closes. */
+
+        poll_num = poll(fds, nfds, coalescer_timeout_ms(&w.coalescer, now_ms()));
         if (poll_num == -1) {
             if (errno == EINTR)
                 continue;
@@ -168,17 +821,52 @@ main(int argc, char* argv[])
 
                 /* Inotify events are available. */
 
-                handle_events(fd, wd, argc, argv);
+                handle_events(&w);
             }
         }
+
+        if (coalescer_timeout_ms(&w.coalescer, now_ms()) == 0)
+            flush_changes(&w);
     }
 
+    flush_changes(&w);
+    if (w.dispatching) {
+        dispatcher_stop(&w.dispatcher);
+        print_dispatch_stats(&w);
+        dispatcher_free(&w.dispatcher);
+    }
     printf("Listening for events stopped.\n");
+    if (snapshot_path != NULL)
+        save_snapshot(&w, snapshot_path);
+    if (w.overflows + w.fan.overflows)
+        printf("Event queue overflowed %lu times.\n",
+               w.overflows + w.fan.overflows);
+    if (w.indexing) {
+        printf("Finishing index...\n");
+        fflush(stdout);
+        if (indexer_close(&w.indexer) == -1)
+            fprintf(stderr, "Cannot save index '%s': %s\n", index_path,
+                    strerror(errno));
+        printf("Indexer: hashed %lu files (%llu bytes), %lu unchanged, "
+               "%lu errors\n", w.indexer.hashed, w.indexer.bytes,
+               w.indexer.unchanged, w.indexer.errors);
+    }
 
     /* Close inotify file descriptor. */
 
-    close(fd);
+    close(w.fd);
+    if (w.use_fanotify)
+        fan_backend_close(&w.fan);
+
+    if (w.logging) {
+        printf("Logged %llu records to %s\n",
+               (unsigned long long) eventlog_head(&w.log), log_dir);
+        eventlog_close(&w.log);
+    }
+    coalescer_free(&w.coalescer);
+    free(w.buf);
+    watch_table_free(&w.watches);
 
-    free(wd);
+    TRACE_EXPORT();
     exit(EXIT_SUCCESS);
 }
\ No newline at end of file
@@ -0,0 +1,251 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <time.h>
+#include <unistd.h>
+#include "coalesce.h"
+#include "eventlog.h"
+
+/* Longest a follower sleeps between looks at an idle log. */
+
+#define MAX_IDLE_NS (100 * 1000000L)
+
+/* How long a claimed but unpublished record may hold up the tail. A
+    writer normally publishes within microseconds of claiming a slot;
+    one that died in between leaves a hole, which is skipped after this
+    long. */
+
+#define HOLE_TIMEOUT_NS (1000 * 1000000LL)
+
+static volatile sig_atomic_t stop;
+
+static void
+on_signal(int sig)
+{
+    (void) sig;
+    stop = 1;
+}
+
+static long long
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Sequence number stored in 'offset_file', or 'fallback' if there is
+    none yet. */
+
+static uint64_t
+load_offset(const char *offset_file, uint64_t fallback)
+{
+    unsigned long long seq;
+    FILE *f = fopen(offset_file, "r");
+
+    if (f == NULL)
+        return fallback;
+    if (fscanf(f, "%llu", &seq) != 1)
+        seq = fallback;
+    fclose(f);
+    return seq;
+}
+
+/* Write the next sequence number to read through a temporary file and
+    rename(), so a crash leaves either the old offset or the new one. */
+
+static int
+save_offset(const char *offset_file, uint64_t seq)
+{
+    char tmp[4096];
+    FILE *f;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", offset_file);
+    f = fopen(tmp, "w");
+    if (f == NULL)
+        return -1;
+    fprintf(f, "%llu\n", (unsigned long long) seq);
+    if (fflush(f) == EOF || fsync(fileno(f)) == -1) {
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+    return rename(tmp, offset_file);
+}
+
+/* Format record 'seq' into line. Returns 1 if the line is good, 0 if
+    the writer reused the slot before or while we looked at it. */
+
+static int
+format_record(const struct eventlog *log, uint64_t seq, char *line, size_t size)
+{
+    const struct eventlog_record *rec = eventlog_slot(log, seq);
+    char names[MASK_NAMES_MAX];
+    uint16_t len;
+
+    if (!eventlog_record_valid(rec, seq))
+        return 0;
+
+    /* path_len is bounded here so a torn record cannot make us read
+        past the slot; the second check below throws such a record away. */
+
+    len = rec->path_len;
+    if (len >= EVENTLOG_PATH_MAX)
+        len = EVENTLOG_PATH_MAX - 1;
+    snprintf(line, size, "%llu %llu.%09llu %s: %.*s%s %s",
+             (unsigned long long) seq,
+             (unsigned long long) (rec->time_ns / 1000000000u),
+             (unsigned long long) (rec->time_ns % 1000000000u),
+             format_mask(rec->mask, names, sizeof(names)),
+             (int) len, rec->path,
+             (rec->flags & EVENTLOG_TRUNCATED) ? "..." : "",
+             (rec->mask & IN_ISDIR) ? "[directory]" : "[file]");
+    if (rec->count > 1) {
+        size_t used = strlen(line);
+        snprintf(line + used, size - used, " x%u", rec->count);
+    }
+    return eventlog_record_valid(rec, seq);
+}
+
+int
+main(int argc, char* argv[])
+{
+    const char *offset_file = NULL;
+    unsigned long long lost = 0, laps = 0, skipped = 0;
+    int opt, follow = 0, have_start = 0;
+    uint64_t next = 0, head, tail, from, hole = UINT64_MAX;
+    long long hole_since = 0;
+    long idle_ns = 1000000L;
+    struct eventlog log;
+    struct sigaction sa;
+    char line[EVENTLOG_PATH_MAX + 256];
+
+    while ((opt = getopt(argc, argv, "fo:s:")) != -1) {
+        switch (opt) {
+        case 'f':
+            follow = 1;
+            break;
+        case 'o':
+            offset_file = optarg;
+            break;
+        case 's':
+            next = strtoull(optarg, NULL, 0);
+            have_start = 1;
+            break;
+        default:
+            optind = argc + 1;      /* force the usage message */
+            break;
+        }
+    }
+
+    if (optind != argc - 1) {
+        printf("Usage: %s [-f] [-o OFFSET_FILE] [-s SEQ] LOGDIR\n", argv[0]);
+        printf("  -f  keep following the log as the watcher appends to it\n");
+        printf("  -o  resume from, and save the next sequence number to, OFFSET_FILE\n");
+        printf("  -s  start at sequence number SEQ (default: oldest record kept)\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (eventlog_open(&log, argv[optind]) == -1) {
+        fprintf(stderr, "Cannot open event log '%s': %s\n", argv[optind],
+                strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    if (!have_start) {
+        next = eventlog_tail(&log);
+        if (offset_file != NULL)
+            next = load_offset(offset_file, next);
+    }
+
+    /* Stop cleanly on Ctrl-C so the offset is saved. No SA_RESTART, so
+        the sleep between polls is cut short. */
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    while (!stop) {
+        head = eventlog_head(&log);
+        tail = eventlog_tail(&log);
+        if (next > head)            /* log was recreated */
+            next = tail;
+        from = next;
+
+        while (next < head && !stop) {
+
+            /* Fell behind by more than the ring holds: the records
+                in between are gone. Skip to the oldest one left. */
+
+            if (next < tail) {
+                fprintf(stderr, "logtail: lapped, %llu records lost\n",
+                        (unsigned long long) (tail - next));
+                lost += tail - next;
+                laps++;
+                next = tail;
+                continue;
+            }
+
+            if (!format_record(&log, next, line, sizeof(line))) {
+                tail = eventlog_tail(&log);
+                if (next < tail)
+                    continue;       /* overwritten: the lap check above reports it */
+
+                /* Claimed by a writer but not published yet. Wait for
+                    it, unless it has been a hole for too long. */
+
+                if (hole != next) {
+                    hole = next;
+                    hole_since = now_ns();
+                    break;
+                }
+                if (now_ns() - hole_since < HOLE_TIMEOUT_NS)
+                    break;
+                fprintf(stderr, "logtail: record %llu never published, skipped\n",
+                        (unsigned long long) next);
+                skipped++;
+                next++;
+                continue;
+            }
+            puts(line);
+            next++;
+        }
+        fflush(stdout);
+
+        if (!follow)
+            break;
+
+        /* Back off while no record could be read, whether the log is
+            idle or the next record is still being written; start fast
+            again as soon as there is progress. */
+
+        if (next == from) {
+            struct timespec ts = { 0, idle_ns };
+
+            if (offset_file != NULL && idle_ns == 1000000L)
+                save_offset(offset_file, next);
+            nanosleep(&ts, NULL);
+            if (idle_ns < MAX_IDLE_NS)
+                idle_ns *= 2;
+        } else {
+            idle_ns = 1000000L;
+        }
+    }
+
+    if (offset_file != NULL && save_offset(offset_file, next) == -1)
+        fprintf(stderr, "Cannot save offset '%s': %s\n", offset_file,
+                strerror(errno));
+    if (laps)
+        fprintf(stderr, "logtail: lapped %llu times, %llu records lost\n",
+                laps, lost);
+    if (skipped)
+        fprintf(stderr, "logtail: %llu unpublished records skipped\n", skipped);
+
+    eventlog_close(&log);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,542 @@
+#define _GNU_SOURCE                 /* asprintf */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "snapshot.h"
+
+/* ---- loading ---- */
+
+int
+snapshot_load(struct snapshot *s, const char *file)
+{
+    struct stat sb;
+    const struct snapshot_header *hdr;
+    size_t records_end;
+    int fd = open(file, O_RDONLY | O_CLOEXEC);
+
+    memset(s, 0, sizeof(*s));
+    if (fd == -1)
+        return -1;
+    if (fstat(fd, &sb) == -1 || (size_t) sb.st_size < sizeof(*hdr)) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+    s->map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (s->map == MAP_FAILED) {
+        s->map = NULL;
+        return -1;
+    }
+    s->map_size = sb.st_size;
+
+    /* Check the header and that the string table is terminated; record
+        fields are bounds-checked as they are used. */
+
+    hdr = s->map;
+    records_end = sizeof(*hdr) + hdr->count * sizeof(struct snapshot_record);
+    if (memcmp(hdr->magic, SNAPSHOT_MAGIC, sizeof(hdr->magic)) != 0 ||
+            hdr->version != SNAPSHOT_VERSION ||
+            hdr->record_size != sizeof(struct snapshot_record) ||
+            hdr->count > s->map_size / sizeof(struct snapshot_record) ||
+            records_end + hdr->strings_size != s->map_size ||
+            (hdr->strings_size > 0 &&
+             ((const char *) s->map)[s->map_size - 1] != '\0')) {
+        snapshot_unload(s);
+        errno = EINVAL;
+        return -1;
+    }
+    s->hdr = hdr;
+    s->recs = (const struct snapshot_record *) (hdr + 1);
+    s->strings = (const char *) s->map + records_end;
+    return 0;
+}
+
+void
+snapshot_unload(struct snapshot *s)
+{
+    if (s->map != NULL)
+        munmap(s->map, s->map_size);
+    memset(s, 0, sizeof(*s));
+}
+
+static const char *
+record_path(const struct snapshot *s, uint32_t i)
+{
+    if (i >= s->hdr->count || s->recs[i].path_off >= s->hdr->strings_size)
+        return NULL;
+    return s->strings + s->recs[i].path_off;
+}
+
+/* Next sibling of record i, clamped so a corrupt file cannot send a walk
+    backwards or out of bounds. */
+
+static uint32_t
+next_sibling(const struct snapshot *s, uint32_t i)
+{
+    uint32_t end = s->recs[i].subtree_end;
+
+    return (end > i && end <= s->hdr->count) ? end : (uint32_t) s->hdr->count;
+}
+
+/* ---- saving ---- */
+
+/* Path order in which every directory sorts directly before its own
+    subtree: plain strcmp, except that '/' sorts below every other byte
+    ("a/b" < "a/b/c" < "a/b-c"). */
+
+static int
+tree_order(const void *a, const void *b)
+{
+    const unsigned char *x = *(const unsigned char **) a;
+    const unsigned char *y = *(const unsigned char **) b;
+
+    for (; *x && *x == *y; x++, y++)
+        ;
+    return (*x == '/' ? 1 : *x) - (*y == '/' ? 1 : *y);
+}
+
+static int
+is_below(const char *path, const char *dir)
+{
+    size_t len = strlen(dir);
+
+    return strncmp(path, dir, len) == 0 && path[len] == '/';
+}
+
+int
+snapshot_save(const char *file, char *const *paths, size_t n_paths)
+{
+    struct snapshot_header hdr;
+    struct snapshot_record *recs;
+    char **sorted;
+    uint32_t *stack;
+    size_t depth = 0, n = 0, strings_size = 0;
+    char tmp[PATH_MAX];
+    FILE *f;
+    int rc = -1;
+
+    sorted = malloc((n_paths + 1) * sizeof(char *));
+    recs = calloc(n_paths + 1, sizeof(*recs));
+    stack = malloc((n_paths + 1) * sizeof(*stack));
+    if (sorted == NULL || recs == NULL || stack == NULL)
+        goto out;
+    memcpy(sorted, paths, n_paths * sizeof(char *));
+    qsort(sorted, n_paths, sizeof(char *), tree_order);
+
+    /* One pass in preorder: the stack holds the chain of ancestors of
+        the current path; anything that is not an ancestor has finished
+        its subtree. */
+
+    for (size_t i = 0; i < n_paths; i++) {
+        struct stat sb;
+
+        if ((i > 0 && strcmp(sorted[i], sorted[i - 1]) == 0) ||
+                lstat(sorted[i], &sb) == -1 || !S_ISDIR(sb.st_mode))
+            continue;               /* duplicate, or gone since we watched it */
+
+        while (depth > 0 && !is_below(sorted[i], sorted[recs[stack[depth - 1]].path_off]))
+            recs[stack[--depth]].subtree_end = n;
+
+        recs[n].ino = sb.st_ino;
+        recs[n].mtime_sec = sb.st_mtim.tv_sec;
+        recs[n].mtime_nsec = sb.st_mtim.tv_nsec;
+        recs[n].parent = depth > 0 ? stack[depth - 1] : SNAPSHOT_NONE;
+        recs[n].path_off = i;       /* index into sorted for now */
+        stack[depth++] = n++;
+    }
+    while (depth > 0)
+        recs[stack[--depth]].subtree_end = n;
+
+    /* Swap sorted indexes for string table offsets. */
+
+    for (size_t r = 0; r < n; r++) {
+        size_t len = strlen(sorted[recs[r].path_off]) + 1;
+        if (strings_size + len > UINT32_MAX) {
+            errno = EFBIG;
+            goto out;
+        }
+        stack[r] = recs[r].path_off;
+        recs[r].path_off = strings_size;
+        strings_size += len;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SNAPSHOT_MAGIC, sizeof(hdr.magic));
+    hdr.version = SNAPSHOT_VERSION;
+    hdr.record_size = sizeof(struct snapshot_record);
+    hdr.count = n;
+    hdr.strings_size = strings_size;
+
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", file) >= (int) sizeof(tmp)) {
+        errno = ENAMETOOLONG;
+        goto out;
+    }
+    if ((f = fopen(tmp, "w")) == NULL)
+        goto out;
+    fwrite(&hdr, sizeof(hdr), 1, f);
+    fwrite(recs, sizeof(*recs), n, f);
+    for (size_t r = 0; r < n; r++)
+        fwrite(sorted[stack[r]], 1, strlen(sorted[stack[r]]) + 1, f);
+    if (ferror(f) || fflush(f) != 0 || fsync(fileno(f)) != 0) {
+        fclose(f);
+        unlink(tmp);
+        goto out;
+    }
+    fclose(f);
+    rc = rename(tmp, file);
+
+out:
+    free(sorted);
+    free(recs);
+    free(stack);
+    return rc;
+}
+
+/* ---- parallel diff ---- */
+
+struct diff_item {
+    uint32_t rec;                   /* snapshot record, or SNAPSHOT_NONE if new */
+    int report;                     /* emit ADDED/REMOVED for this one (not its descendants) */
+    char *path;
+};
+
+struct diff_ctx {
+    const struct snapshot *s;
+    struct snapshot_diff *out;
+
+    pthread_mutex_t lock;           /* protects everything below */
+    pthread_cond_t more;
+    struct diff_item *items;        /* work stack */
+    size_t n_items, cap_items;
+    int busy;                       /* workers currently processing an item */
+    size_t cap_live, cap_changes;
+    int failed;
+};
+
+/* Callers hold ctx->lock for the three helpers below. */
+
+static void
+push_item(struct diff_ctx *ctx, uint32_t rec, int report, char *path)
+{
+    if (path == NULL) {
+        ctx->failed = 1;
+        return;
+    }
+    if (ctx->n_items == ctx->cap_items) {
+        size_t cap = ctx->cap_items ? ctx->cap_items * 2 : 256;
+        struct diff_item *grown = realloc(ctx->items, cap * sizeof(*grown));
+        if (grown == NULL) {
+            free(path);
+            ctx->failed = 1;
+            return;
+        }
+        ctx->items = grown;
+        ctx->cap_items = cap;
+    }
+    ctx->items[ctx->n_items].rec = rec;
+    ctx->items[ctx->n_items].report = report;
+    ctx->items[ctx->n_items].path = path;
+    ctx->n_items++;
+    pthread_cond_signal(&ctx->more);
+}
+
+static void
+add_change(struct diff_ctx *ctx, enum snapshot_change_kind kind, const char *path)
+{
+    struct snapshot_diff *out = ctx->out;
+
+    if (out->n_changes == ctx->cap_changes) {
+        size_t cap = ctx->cap_changes ? ctx->cap_changes * 2 : 64;
+        struct snapshot_change *grown = realloc(out->changes, cap * sizeof(*grown));
+        if (grown == NULL) {
+            ctx->failed = 1;
+            return;
+        }
+        out->changes = grown;
+        ctx->cap_changes = cap;
+    }
+    if ((out->changes[out->n_changes].path = strdup(path)) == NULL) {
+        ctx->failed = 1;
+        return;
+    }
+    out->changes[out->n_changes++].kind = kind;
+}
+
+static void
+add_live(struct diff_ctx *ctx, char *path)
+{
+    struct snapshot_diff *out = ctx->out;
+
+    if (out->n_live == ctx->cap_live) {
+        size_t cap = ctx->cap_live ? ctx->cap_live * 2 : 1024;
+        char **grown = realloc(out->live, cap * sizeof(*grown));
+        if (grown == NULL) {
+            free(path);
+            ctx->failed = 1;
+            return;
+        }
+        out->live = grown;
+        ctx->cap_live = cap;
+    }
+    out->live[out->n_live++] = path;
+}
+
+static char *
+join(const char *dir, const char *name)
+{
+    char *path;
+
+    if (asprintf(&path, "%s/%s", dir, name) == -1)
+        return NULL;
+    return path;
+}
+
+static const char *
+basename_of(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+
+    return slash ? slash + 1 : path;
+}
+
+static int
+cmp_names(const void *a, const void *b)
+{
+    return strcmp(*(const char **) a, *(const char **) b);
+}
+
+/* Read a changed (or new) directory and pair its subdirectories with
+    the snapshot's children by name. Both lists are in strcmp order
+    (see tree_order), so this is a merge. */
+
+static void
+diff_readdir(struct diff_ctx *ctx, const struct diff_item *item)
+{
+    const struct snapshot *s = ctx->s;
+    DIR *d = opendir(item->path);
+    struct dirent *ent;
+    char **names = NULL;
+    size_t n_names = 0, cap = 0;
+    uint32_t child, end;
+
+    if (d == NULL)
+        return;
+    while ((ent = readdir(d)) != NULL) {
+        struct stat sb;
+
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+            continue;
+        if (ent->d_type == DT_UNKNOWN) {
+            if (fstatat(dirfd(d), ent->d_name, &sb, AT_SYMLINK_NOFOLLOW) == -1 ||
+                    !S_ISDIR(sb.st_mode))
+                continue;
+        } else if (ent->d_type != DT_DIR) {
+            continue;
+        }
+        if (n_names == cap) {
+            char **grown = realloc(names, (cap = cap ? cap * 2 : 32) * sizeof(char *));
+            if (grown == NULL)
+                break;
+            names = grown;
+        }
+        if ((names[n_names] = strdup(ent->d_name)) != NULL)
+            n_names++;
+    }
+    closedir(d);
+    qsort(names, n_names, sizeof(char *), cmp_names);
+
+    pthread_mutex_lock(&ctx->lock);
+    if (item->rec != SNAPSHOT_NONE) {
+        child = item->rec + 1;
+        end = next_sibling(s, item->rec);
+    } else {
+        child = end = 0;
+    }
+    for (size_t i = 0; i < n_names || child < end;) {
+        const char *path = child < end ? record_path(s, child) : NULL;
+        int c;
+
+        if (child < end && path == NULL)
+            break;                  /* corrupt record: stop pairing */
+        if (i == n_names)
+            c = 1;
+        else if (child == end)
+            c = -1;
+        else
+            c = strcmp(names[i], basename_of(path));
+
+        if (c < 0) {                /* only on disk: new */
+            push_item(ctx, SNAPSHOT_NONE, item->report, join(item->path, names[i]));
+            i++;
+        } else if (c > 0) {         /* only in the snapshot: gone */
+            add_change(ctx, SNAPSHOT_REMOVED, path);
+            child = next_sibling(s, child);
+        } else {
+            push_item(ctx, child, 1, join(item->path, names[i]));
+            i++;
+            child = next_sibling(s, child);
+        }
+    }
+    pthread_mutex_unlock(&ctx->lock);
+
+    for (size_t i = 0; i < n_names; i++)
+        free(names[i]);
+    free(names);
+}
+
+static void
+diff_one(struct diff_ctx *ctx, struct diff_item *item)
+{
+    const struct snapshot *s = ctx->s;
+    const struct snapshot_record *rec =
+        item->rec != SNAPSHOT_NONE ? &s->recs[item->rec] : NULL;
+    struct stat sb;
+
+    if (lstat(item->path, &sb) == -1 || !S_ISDIR(sb.st_mode)) {
+        pthread_mutex_lock(&ctx->lock);
+        if (rec != NULL && item->report)
+            add_change(ctx, SNAPSHOT_REMOVED, item->path);
+        pthread_mutex_unlock(&ctx->lock);
+        free(item->path);
+        return;
+    }
+
+    if (rec != NULL && rec->ino == (uint64_t) sb.st_ino &&
+            rec->mtime_sec == sb.st_mtim.tv_sec &&
+            rec->mtime_nsec == (uint32_t) sb.st_mtim.tv_nsec) {
+
+        /* Same entries as last time: take the subdirectories from the
+            snapshot instead of reading the directory. */
+
+        pthread_mutex_lock(&ctx->lock);
+        for (uint32_t c = item->rec + 1; c < next_sibling(s, item->rec);
+                c = next_sibling(s, c)) {
+            const char *path = record_path(s, c);
+            if (path != NULL)
+                push_item(ctx, c, 1, strdup(path));
+        }
+        add_live(ctx, item->path);
+        pthread_mutex_unlock(&ctx->lock);
+        return;
+    }
+
+    pthread_mutex_lock(&ctx->lock);
+    if (rec != NULL)
+        add_change(ctx, SNAPSHOT_CHANGED, item->path);
+    else if (item->report)
+        add_change(ctx, SNAPSHOT_ADDED, item->path);
+    ctx->out->read_dirs++;
+    pthread_mutex_unlock(&ctx->lock);
+
+    /* Below a new directory everything is new; report only the top. */
+
+    if (rec == NULL) {
+        struct diff_item quiet = *item;
+        quiet.report = 0;
+        diff_readdir(ctx, &quiet);
+    } else {
+        diff_readdir(ctx, item);
+    }
+
+    pthread_mutex_lock(&ctx->lock);
+    add_live(ctx, item->path);
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+static void *
+diff_worker(void *arg)
+{
+    struct diff_ctx *ctx = arg;
+
+    pthread_mutex_lock(&ctx->lock);
+    for (;;) {
+        struct diff_item item;
+
+        while (ctx->n_items == 0 && ctx->busy > 0)
+            pthread_cond_wait(&ctx->more, &ctx->lock);
+        if (ctx->n_items == 0)
+            break;                  /* nothing queued and nobody can queue more */
+        item = ctx->items[--ctx->n_items];
+        ctx->busy++;
+        pthread_mutex_unlock(&ctx->lock);
+
+        diff_one(ctx, &item);
+
+        pthread_mutex_lock(&ctx->lock);
+        if (--ctx->busy == 0 && ctx->n_items == 0)
+            pthread_cond_broadcast(&ctx->more);
+    }
+    pthread_mutex_unlock(&ctx->lock);
+    return NULL;
+}
+
+int
+snapshot_diff(const struct snapshot *s, char *const roots[], int n_roots,
+              int n_threads, struct snapshot_diff *out)
+{
+    struct diff_ctx ctx;
+    pthread_t *threads;
+    int started = 0;
+
+    memset(out, 0, sizeof(*out));
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.s = s;
+    ctx.out = out;
+    pthread_mutex_init(&ctx.lock, NULL);
+    pthread_cond_init(&ctx.more, NULL);
+
+    /* Seed the work stack with each root and its snapshot record. */
+
+    for (int r = 0; r < n_roots; r++) {
+        uint32_t rec = SNAPSHOT_NONE;
+
+        for (uint32_t i = 0; i < s->hdr->count; i = next_sibling(s, i)) {
+            const char *path = record_path(s, i);
+            if (path != NULL && strcmp(path, roots[r]) == 0) {
+                rec = i;
+                break;
+            }
+        }
+        push_item(&ctx, rec, 1, strdup(roots[r]));
+    }
+
+    threads = calloc(n_threads, sizeof(pthread_t));
+    for (; threads != NULL && started < n_threads; started++)
+        if (pthread_create(&threads[started], NULL, diff_worker, &ctx) != 0)
+            break;
+    if (started == 0)
+        diff_worker(&ctx);          /* no threads: do it ourselves */
+    for (int i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    free(threads);
+    free(ctx.items);
+    pthread_mutex_destroy(&ctx.lock);
+    pthread_cond_destroy(&ctx.more);
+    if (ctx.failed) {
+        snapshot_diff_free(out);
+        return -1;
+    }
+    return 0;
+}
+
+void
+snapshot_diff_free(struct snapshot_diff *d)
+{
+    for (size_t i = 0; i < d->n_live; i++)
+        free(d->live[i]);
+    for (size_t i = 0; i < d->n_changes; i++)
+        free(d->changes[i].path);
+    free(d->live);
+    free(d->changes);
+    memset(d, 0, sizeof(*d));
+}
@@ -0,0 +1,84 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Persisted picture of the watched directory tree, used to restart the
+    watcher quickly and to report what changed while it was down.
+
+    The file is a header, a flat array of fixed-size records and a
+    string table, written in DFS preorder so it can be mmap'd and
+    walked in place with no parsing: the children of record i start at
+    i + 1 and each child's subtree_end jumps to the next sibling.
+
+    On startup the snapshot is diffed against the live filesystem by a
+    pool of threads. A directory whose inode and mtime are unchanged
+    still has the same entries, so it is not read: its subdirectories
+    are taken from the snapshot and only stat()ed. Only directories
+    that changed are read with readdir(). */
+
+#define SNAPSHOT_MAGIC "INOSNAP1"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_NONE UINT32_MAX    /* parent of a root record */
+
+struct snapshot_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;           /* sizeof(struct snapshot_record) */
+    uint64_t count;                 /* number of records */
+    uint64_t strings_size;          /* bytes of string table after the records */
+};
+
+struct snapshot_record {
+    uint64_t ino;
+    int64_t mtime_sec;
+    uint32_t mtime_nsec;
+    uint32_t path_off;              /* NUL-terminated full path in the string table */
+    uint32_t parent;                /* record index, SNAPSHOT_NONE for roots */
+    uint32_t subtree_end;           /* one past the last record below this one */
+};
+
+struct snapshot {
+    void *map;
+    size_t map_size;
+    const struct snapshot_header *hdr;
+    const struct snapshot_record *recs;
+    const char *strings;
+};
+
+enum snapshot_change_kind {
+    SNAPSHOT_ADDED,                 /* directory did not exist before */
+    SNAPSHOT_REMOVED,               /* directory (and everything below) is gone */
+    SNAPSHOT_CHANGED,               /* directory entries were added/removed/renamed */
+};
+
+struct snapshot_change {
+    enum snapshot_change_kind kind;
+    char *path;
+};
+
+struct snapshot_diff {
+    char **live;                    /* every directory that exists now */
+    size_t n_live;
+    struct snapshot_change *changes;
+    size_t n_changes;
+    size_t read_dirs;               /* directories that needed readdir() */
+};
+
+/* Map 'file'. Returns 0, or -1 with errno set (ENOENT: no snapshot yet,
+    EINVAL: not a snapshot or from another version). */
+int snapshot_load(struct snapshot *s, const char *file);
+void snapshot_unload(struct snapshot *s);
+
+/* Write a snapshot of the directories in 'paths' (stat'ing each one
+    now) to 'file', atomically. Returns 0, or -1 with errno set. */
+int snapshot_save(const char *file, char *const *paths, size_t n_paths);
+
+/* Compare the snapshot with the live trees under 'roots' using
+    n_threads threads. Returns 0, or -1 if memory ran out. */
+int snapshot_diff(const struct snapshot *s, char *const roots[], int n_roots,
+                  int n_threads, struct snapshot_diff *out);
+void snapshot_diff_free(struct snapshot_diff *d);
+
+#endif
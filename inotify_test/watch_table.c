@@ -0,0 +1,167 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "watch_table.h"
+
+#define MIN_CAPACITY 64
+
+/* Grow once the table is 70% full; linear probing degrades quickly
+    past that. */
+#define MAX_LOAD(capacity) ((capacity) / 10 * 7)
+
+static size_t
+slot_for(const struct watch_table *table, int wd)
+{
+    /* Fibonacci hashing: multiply by 2^64/phi and keep the top
+        log2(capacity) bits, so consecutive wds land far apart. */
+
+    uint64_t h = (uint64_t) (unsigned int) wd * 11400714819323198485ull;
+    return (size_t) (h >> table->shift);
+}
+
+static void
+set_capacity(struct watch_table *table, size_t capacity)
+{
+    table->capacity = capacity;
+    table->shift = 64;
+    while (capacity > 1) {
+        capacity >>= 1;
+        table->shift--;
+    }
+}
+
+int
+watch_table_init(struct watch_table *table, size_t capacity_hint)
+{
+    size_t capacity = MIN_CAPACITY;
+
+    while (MAX_LOAD(capacity) < capacity_hint)
+        capacity *= 2;
+
+    table->slots = calloc(capacity, sizeof(struct watch_entry));
+    if (table->slots == NULL)
+        return -1;
+    set_capacity(table, capacity);
+    table->count = 0;
+    return 0;
+}
+
+void
+watch_table_free(struct watch_table *table)
+{
+    for (size_t i = 0; i < table->capacity; i++)
+        free(table->slots[i].path);
+    free(table->slots);
+    table->slots = NULL;
+    table->capacity = table->count = 0;
+}
+
+/* Place an entry known not to be in the table. Used by put and by
+    resize, which moves the path pointers without copying them. */
+
+static struct watch_entry *
+insert_entry(struct watch_table *table, struct watch_entry entry)
+{
+    size_t i = slot_for(table, entry.wd);
+
+    while (table->slots[i].wd != 0)
+        i = (i + 1) & (table->capacity - 1);
+    table->slots[i] = entry;
+    table->count++;
+    return &table->slots[i];
+}
+
+static int
+resize(struct watch_table *table, size_t capacity)
+{
+    struct watch_entry *old = table->slots;
+    size_t old_capacity = table->capacity;
+
+    table->slots = calloc(capacity, sizeof(struct watch_entry));
+    if (table->slots == NULL) {
+        table->slots = old;
+        return -1;
+    }
+    set_capacity(table, capacity);
+    table->count = 0;
+
+    for (size_t i = 0; i < old_capacity; i++)
+        if (old[i].wd != 0)
+            insert_entry(table, old[i]);
+    free(old);
+    return 0;
+}
+
+struct watch_entry *
+watch_table_put(struct watch_table *table, int wd, const char *path)
+{
+    struct watch_entry entry;
+    size_t i = slot_for(table, wd);
+    char *copy = strdup(path);
+
+    if (copy == NULL)
+        return NULL;
+
+    /* Existing wd: replace the path in place. */
+
+    for (; table->slots[i].wd != 0; i = (i + 1) & (table->capacity - 1)) {
+        if (table->slots[i].wd == wd) {
+            free(table->slots[i].path);
+            table->slots[i].path = copy;
+            return &table->slots[i];
+        }
+    }
+
+    if (table->count + 1 > MAX_LOAD(table->capacity)
+            && resize(table, table->capacity * 2) == -1) {
+        free(copy);
+        return NULL;
+    }
+
+    memset(&entry, 0, sizeof(entry));
+    entry.wd = wd;
+    entry.path = copy;
+    return insert_entry(table, entry);
+}
+
+const char *
+watch_table_get(const struct watch_table *table, int wd)
+{
+    size_t i = slot_for(table, wd);
+
+    for (; table->slots[i].wd != 0; i = (i + 1) & (table->capacity - 1))
+        if (table->slots[i].wd == wd)
+            return table->slots[i].path;
+    return NULL;
+}
+
+void
+watch_table_remove(struct watch_table *table, int wd)
+{
+    size_t mask = table->capacity - 1;
+    size_t i = slot_for(table, wd);
+
+    while (table->slots[i].wd != wd) {
+        if (table->slots[i].wd == 0)
+            return;
+        i = (i + 1) & mask;
+    }
+    free(table->slots[i].path);
+    table->count--;
+
+    /* Backward-shift deletion: instead of leaving a tombstone, pull
+        later members of the probe run back into the hole so lookups
+        never have to skip over dead slots. An entry may move into the
+        hole only if its home slot is not cyclically between the hole
+        and its current position. */
+
+    for (size_t j = (i + 1) & mask; table->slots[j].wd != 0; j = (j + 1) & mask) {
+        size_t home = slot_for(table, table->slots[j].wd);
+
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            table->slots[i] = table->slots[j];
+            i = j;
+        }
+    }
+    memset(&table->slots[i], 0, sizeof(table->slots[i]));
+}
@@ -0,0 +1,45 @@
+#ifndef WATCH_TABLE_H
+#define WATCH_TABLE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+
+/* Maps inotify watch descriptors back to the path they watch.
+    Open addressing with linear probing, keyed by wd. Watch descriptors
+    are small sequential integers, so a multiplicative (Fibonacci) hash
+    spreads them over the table; lookups stay O(1) at 100k+ watches
+    where scanning a wd array per event would not. Slots with wd == 0
+    are empty (the kernel never hands out wd 0). */
+
+struct watch_entry {
+    int wd;
+    char *path;             /* owned by the table */
+    ino_t ino;              /* directory identity and mtime as of the */
+    struct timespec mtime;  /* last time we looked, for targeted rescans */
+};
+
+struct watch_table {
+    struct watch_entry *slots;
+    size_t capacity;        /* always a power of two */
+    unsigned int shift;     /* 64 - log2(capacity), for slot_for() */
+    size_t count;
+};
+
+int watch_table_init(struct watch_table *table, size_t capacity_hint);
+void watch_table_free(struct watch_table *table);
+
+/* Insert wd -> path, or update the path if wd is already present
+    (inotify_add_watch returns the existing wd when an inode is
+    re-added, e.g. after a directory was renamed). Returns the entry,
+    valid until the next put or remove, or NULL if memory ran out. */
+struct watch_entry *watch_table_put(struct watch_table *table, int wd,
+                                    const char *path);
+
+/* Returns the watched path for wd, or NULL if wd is unknown. */
+const char *watch_table_get(const struct watch_table *table, int wd);
+
+/* Forget wd. No-op if it is not present. */
+void watch_table_remove(struct watch_table *table, int wd);
+
+#endif
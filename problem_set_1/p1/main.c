@@ -5,6 +5,7 @@
 #include <time.h>
 #include <unistd.h>
 #include "reader.h"
+#include "trace.h"
 #include "writer.h"
 
 // https://stackoverflow.com/questions/37538/how-do-i-determine-the-size-of-my-array-in-c
@@ -47,6 +48,7 @@ void *do_n_times_with_delay(void *args) {
     */
     function_runner_t *input = (function_runner_t *) args;  // inform compiler this is a pointer to a struct
     int seconds;
+    TRACE_THREAD_NAME(input->func == &read_func ? "reader" : "writer");
     for (int i = 0; i < input->n; i++) {
         seconds = rand() % 5 + 1;
         sleep(seconds);
@@ -117,6 +119,8 @@ int main(int argc, char* argv[]) {
     }
     printf("Done joining writer threads\n");
 
+    TRACE_EXPORT();  // no-op unless built with make TRACE=1
+
     free(read_phase);
     free(write_phase);
 
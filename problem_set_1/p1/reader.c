@@ -4,6 +4,7 @@
 #include <pthread.h>
 #include <time.h>
 #include <unistd.h>
+#include "trace.h"
 
 // TODO: make these arguments instead of globals, or make this a struct
 extern int resource_counter;  // convention is positive=readers, negative=writer(s)
@@ -13,11 +14,11 @@ extern pthread_cond_t *read_phase;  // condition signalling ok for reader to get
 extern pthread_cond_t *write_phase;  // condition signalling ok for writer to get lock
 extern char X;
 
-void *read_func(void *args) {
-    // READERS HAVE PRIO
-    pthread_t mythread = pthread_self();
-
+// Reader side of the lock protocol, split out of read_func so it can be
+// exercised (and benchmarked) without the prints and sleeps around it.
+void reader_enter(void) {
     // request permission to read. Once granted, increment reader counter
+    TRACE_BEGIN("read_lock_wait");
     pthread_mutex_lock(&lock);
     while (resource_counter < 0) {
         reader_queue++;
@@ -26,15 +27,10 @@ void *read_func(void *args) {
     }
     resource_counter++;
     pthread_mutex_unlock(&lock);
+    TRACE_END("read_lock_wait");
+}
 
-    //  ---- enter critical section
-    printf("Thread %lu: READ X: %c\n", mythread, X);
-    printf("Thread %lu: there are %d total readers\n", mythread, resource_counter);
-
-    // hang out here a while to prove other readers seeing me
-    sleep(1);
-    //  ---- exit critical section
-
+void reader_exit(void) {
     // decrement reader counter
     pthread_mutex_lock(&lock);
     resource_counter--;
@@ -44,5 +40,24 @@ void *read_func(void *args) {
         pthread_cond_signal(write_phase);
     }
     pthread_mutex_unlock(&lock);
+}
+
+void *read_func(void *args) {
+    // READERS HAVE PRIO
+    pthread_t mythread = pthread_self();
+
+    reader_enter();
+
+    //  ---- enter critical section
+    TRACE_BEGIN("read");
+    printf("Thread %lu: READ X: %c\n", mythread, X);
+    printf("Thread %lu: there are %d total readers\n", mythread, resource_counter);
+
+    // hang out here a while to prove other readers seeing me
+    sleep(1);
+    TRACE_END("read");
+    //  ---- exit critical section
+
+    reader_exit();
     return NULL;
 }
\ No newline at end of file
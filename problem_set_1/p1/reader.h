@@ -3,5 +3,7 @@
 
 // function prototypes
 void *read_func(void *args);
+void reader_enter(void);
+void reader_exit(void);
 
 #endif
\ No newline at end of file
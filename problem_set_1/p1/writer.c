@@ -4,6 +4,7 @@
 #include <pthread.h>
 #include <time.h>
 #include <unistd.h>
+#include "trace.h"
 
 // TODO: make these arguments instead of globals, or make this a struct
 extern int resource_counter;  // convention is positive=readers, negative=writer(s)
@@ -13,21 +14,20 @@ extern pthread_cond_t *read_phase;  // condition signalling ok for reader to get
 extern pthread_cond_t *write_phase;  // condition signalling ok for writer to get lock
 extern char X;
 
-void *write_func(void *args) {
-    pthread_t mythread = pthread_self();
-
+// Writer side of the lock protocol, split out of write_func so it can be
+// exercised (and benchmarked) without the prints around it.
+void writer_enter(void) {
+    TRACE_BEGIN("write_lock_wait");
     pthread_mutex_lock(&lock);
     while (resource_counter != 0) {
         pthread_cond_wait(write_phase, &lock);
     }
     resource_counter--;
     pthread_mutex_unlock(&lock);
-    
-    // ---- enter critical section
-    printf("Thread %lu: WROTE X: %c\n", mythread, X);
-    printf("Thread %lu: there are %d total readers\n", mythread, resource_counter);
-    // ---- exit critical section
+    TRACE_END("write_lock_wait");
+}
 
+void writer_exit(void) {
     pthread_mutex_lock(&lock);
     resource_counter++;
     // we must check the queue, which is a protected resource, so cannot unlock here
@@ -44,6 +44,20 @@ void *write_func(void *args) {
         // we don't think there are any readers waiting, safe to signal a writer
         pthread_cond_signal(write_phase);
     }
+}
+
+void *write_func(void *args) {
+    pthread_t mythread = pthread_self();
+
+    writer_enter();
+
+    // ---- enter critical section
+    TRACE_BEGIN("write");
+    printf("Thread %lu: WROTE X: %c\n", mythread, X);
+    printf("Thread %lu: there are %d total readers\n", mythread, resource_counter);
+    TRACE_END("write");
+    // ---- exit critical section
 
+    writer_exit();
     return NULL;
 }
\ No newline at end of file
@@ -3,5 +3,7 @@
 
 // Function prototypes
 void *write_func(void *args);
+void writer_enter(void);
+void writer_exit(void);
 
 #endif
\ No newline at end of file
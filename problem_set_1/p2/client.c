@@ -1,10 +1,16 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>  // close()
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <netinet/in.h>
 #include <netdb.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>  // fcntl, O_NONBLOCK
+#include <poll.h>
+#include <time.h>  // clock_gettime
+#include <sys/time.h>  // struct timeval
 
 /*
 Write a simple C program that creates, initializes, and connects a client socket
@@ -12,96 +18,411 @@ to a server socket. You should provide a way to specify the connecting server
 address and port. This can be hardcoded or passed via the command line.
 */
 // https://www.codequoi.com/en/sockets-and-network-programming-in-c/
+// https://datatracker.ietf.org/doc/html/rfc8305  (Happy Eyeballs v2)
 
 #define DEFAULT_SERVER "127.0.0.1"  // loopback IPv4 addr
 #define DEFAULT_PORT "8080"  // convention for alternative http
+#define DEFAULT_REQUESTS 1
 #define NELEMS(x)  (sizeof(x) / sizeof((x)[0]))  // do not use with pointers :)
 
+#define CONNECT_STAGGER_MS 250  // RFC 8305 "Connection Attempt Delay" between starting attempts
+#define CONNECT_TIMEOUT_MS 5000  // give up if nothing has connected after this long
+#define MAX_ATTEMPTS 32  // cap on addresses we will race against each other
+#define POOL_SIZE 16  // idle connections kept around for reuse
+#define POOL_KEY_LEN 300  // "host:port", host is at most 255 chars
+#define RECV_TIMEOUT_S 5  // a server that goes quiet shouldn't hang us forever
 
-int main(int argc, char *argv[]) {
-    // default server and client
-    const char *server = DEFAULT_SERVER;
-    // above, const applies to the data that server points to, not the pointer itself
-    // above, assigning a pointer to a character array like this is equivalent to = &DEFAULT_SERVER[0] (the array "decays" to a pointer)
-    const char *port = DEFAULT_PORT;
 
-    // override defaults if user wants
-    if (argc >= 2) {
-        server = argv[1];  // custom server
+/*
+An idle, already-connected socket, keyed by "host:port".
+fd == -1 marks an empty slot.
+*/
+typedef struct {
+    char key[POOL_KEY_LEN];
+    int fd;
+    long last_used_ms;
+} pooled_conn_t;
+
+typedef struct {
+    pooled_conn_t slots[POOL_SIZE];
+} conn_pool_t;
+
+
+// monotonic milliseconds, only ever used for differences
+long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+void pool_init(conn_pool_t *pool) {
+    for (int i = 0; i < POOL_SIZE; i++) {
+        pool->slots[i].fd = -1;
     }
-    if (argc == 3) {
-        port = argv[2];  // custom port
+}
+
+/*
+Check whether an idle pooled socket is still usable.
+A peek that returns 0 means the server sent FIN while we were idle, and any other
+data or error means the connection is not in the clean "waiting for our request" state.
+Only "nothing to read right now" (EAGAIN) means it is safe to reuse.
+*/
+int conn_is_alive(int fd) {
+    char c;
+    ssize_t n = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+/*
+Take an idle connection for key out of the pool.
+Stale connections found along the way are closed and dropped.
+Returns the fd, or -1 if nothing reusable is pooled for this key.
+*/
+int pool_get(conn_pool_t *pool, const char *key) {
+    for (int i = 0; i < POOL_SIZE; i++) {
+        pooled_conn_t *slot = &pool->slots[i];
+        if (slot->fd == -1 || strcmp(slot->key, key) != 0) {
+            continue;
+        }
+        int fd = slot->fd;
+        slot->fd = -1;  // either way this slot is now empty
+        if (conn_is_alive(fd)) {
+            return fd;
+        }
+        close(fd);
     }
-    if (argc > 3) {
-        fprintf(stderr, "usage: client [<server>] [<port>]\n");
-        fprintf(stderr, "defaults: %s, %s\n", DEFAULT_SERVER, DEFAULT_PORT);
-        return 1;
+    return -1;
+}
+
+/*
+Return a healthy connection to the pool so a later request to the same host:port
+can skip resolving and connecting. When the pool is full the least recently used
+connection is closed to make room.
+*/
+void pool_put(conn_pool_t *pool, const char *key, int fd) {
+    pooled_conn_t *victim = &pool->slots[0];
+    for (int i = 0; i < POOL_SIZE; i++) {
+        pooled_conn_t *slot = &pool->slots[i];
+        if (slot->fd == -1) {
+            victim = slot;
+            break;
+        }
+        if (slot->last_used_ms < victim->last_used_ms) {
+            victim = slot;
+        }
     }
+    if (victim->fd != -1) {
+        close(victim->fd);
+    }
+    snprintf(victim->key, sizeof(victim->key), "%s", key);
+    victim->fd = fd;
+    victim->last_used_ms = now_ms();
+}
 
-    // print connection details
-    printf("Connecting to %s:%s\n", server, port);
+void pool_close_all(conn_pool_t *pool) {
+    for (int i = 0; i < POOL_SIZE; i++) {
+        if (pool->slots[i].fd != -1) {
+            close(pool->slots[i].fd);
+            pool->slots[i].fd = -1;
+        }
+    }
+}
+
+/*
+Reorder getaddrinfo results so address families alternate (v6, v4, v6, ...),
+keeping the resolver's preference order within each family. That way a broken
+IPv6 path only ever costs one stagger delay before IPv4 gets a turn.
+Returns the number of entries written to out.
+*/
+int interleave_families(struct addrinfo *res, struct addrinfo **out, int max) {
+    struct addrinfo *first[MAX_ATTEMPTS], *rest[MAX_ATTEMPTS];
+    int n_first = 0, n_rest = 0, n = 0;
+    int first_family = res->ai_family;  // whatever the resolver liked best goes first
+
+    for (struct addrinfo *p = res; p != NULL; p = p->ai_next) {
+        if (p->ai_family == first_family && n_first < max) {
+            first[n_first++] = p;
+        } else if (p->ai_family != first_family && n_rest < max) {
+            rest[n_rest++] = p;
+        }
+    }
+    for (int i = 0; n < max && (i < n_first || i < n_rest); i++) {
+        if (i < n_first) {
+            out[n++] = first[i];
+        }
+        if (i < n_rest && n < max) {
+            out[n++] = rest[i];
+        }
+    }
+    return n;
+}
+
+/*
+Start a non-blocking connect to a single address.
+Returns the socket fd (connected or still in progress), or -1 if it failed outright.
+*connected is set when the connect finished immediately (common on loopback).
+*/
+int start_attempt(struct addrinfo *p, int *connected) {
+    int fd;
+    //                domain=IPv4/6  type=socktype    protocol=default this
+    if ((fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) < 0) {
+        return -1;
+    }
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        close(fd);
+        return -1;
+    }
+    *connected = 0;
+    if (connect(fd, p->ai_addr, p->ai_addrlen) == 0) {
+        *connected = 1;
+    } else if (errno != EINPROGRESS) {
+        close(fd);  // don't leak sockets that failed to connect
+        return -1;
+    }
+    return fd;
+}
+
+/*
+"Happy eyeballs" connect: race all resolved addresses against each other.
+A new attempt is started every CONNECT_STAGGER_MS (or immediately when an earlier
+one fails) and the first socket to finish connecting wins. Every losing socket
+is closed. The winner is switched back to blocking mode before being returned.
+Returns the connected fd, or -1 if nothing connected. *tries counts attempts started.
+*/
+int happy_eyeballs_connect(struct addrinfo *res, int *tries) {
+    struct addrinfo *order[MAX_ATTEMPTS];
+    int n_addrs = interleave_families(res, order, MAX_ATTEMPTS);
+    struct pollfd in_flight[MAX_ATTEMPTS];
+    int n_in_flight = 0, next = 0, winner = -1;
+    long deadline = now_ms() + CONNECT_TIMEOUT_MS;
+    long next_start = now_ms();  // first attempt goes right away
+
+    *tries = 0;
+    while (winner == -1 && now_ms() < deadline) {
+        // kick off the next address if its turn has come, or if nothing is pending
+        if (next < n_addrs && (n_in_flight == 0 || now_ms() >= next_start)) {
+            int connected;
+            int fd = start_attempt(order[next++], &connected);
+            (*tries)++;
+            if (fd == -1) {
+                continue;  // failed immediately, move straight on to the next address
+            }
+            if (connected) {
+                winner = fd;
+                break;
+            }
+            in_flight[n_in_flight].fd = fd;
+            in_flight[n_in_flight].events = POLLOUT;
+            n_in_flight++;
+            next_start = now_ms() + CONNECT_STAGGER_MS;
+        }
+
+        if (n_in_flight == 0) {
+            if (next >= n_addrs) {
+                break;  // every address failed
+            }
+            continue;
+        }
+
+        // wait for some attempt to finish, but wake up in time to start the next one
+        long wake = (next < n_addrs) ? next_start : deadline;
+        int timeout = (int) (wake - now_ms());
+        if (timeout < 0) {
+            timeout = 0;
+        }
+        if (poll(in_flight, n_in_flight, timeout) == -1) {
+            if (errno == EINTR) {
+                continue;  // revents are stale after an interrupted poll, don't scan them
+            }
+            break;
+        }
+
+        for (int i = 0; i < n_in_flight; i++) {
+            if (in_flight[i].revents == 0) {
+                continue;
+            }
+            int err = 0;
+            socklen_t err_len = sizeof(err);
+            getsockopt(in_flight[i].fd, SOL_SOCKET, SO_ERROR, &err, &err_len);
+            if (err == 0 && winner == -1) {
+                winner = in_flight[i].fd;
+            } else {
+                close(in_flight[i].fd);
+                next_start = now_ms();  // a failure lets the next address go immediately
+            }
+            in_flight[i--] = in_flight[--n_in_flight];  // swap-remove, recheck this index
+        }
+    }
+
+    // losers get closed, whether they were about to succeed or not
+    for (int i = 0; i < n_in_flight; i++) {
+        close(in_flight[i].fd);
+    }
+
+    if (winner != -1) {
+        int flags = fcntl(winner, F_GETFL, 0);
+        fcntl(winner, F_SETFL, flags & ~O_NONBLOCK);  // rest of the client uses blocking send/recv
+        struct timeval tv = { .tv_sec = RECV_TIMEOUT_S, .tv_usec = 0 };
+        setsockopt(winner, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    }
+    return winner;
+}
+
+/*
+Get a connection to server:port, reusing a pooled one when we can.
+*fresh is set when this is a brand new connection (the server will greet us first).
+Returns the fd, or -1 on failure.
+*/
+int pool_connect(conn_pool_t *pool, const char *server, const char *port, int *fresh) {
+    char key[POOL_KEY_LEN];
+    snprintf(key, sizeof(key), "%s:%s", server, port);
+
+    int fd = pool_get(pool, key);
+    if (fd != -1) {
+        printf("Reusing pooled connection %d to %s\n", fd, key);
+        *fresh = 0;
+        return fd;
+    }
 
     // resolve server address
-    struct addrinfo hints, *res, *p;
-    int status;
-    int socketfd;
-    int tries =0;
-    
+    struct addrinfo hints, *res;
+    int status, tries;
+
     memset(&hints, 0, sizeof(hints));
-    hints.ai_family = AF_INET;  // IPv4
+    hints.ai_family = AF_UNSPEC;  // IPv4 or IPv6, we race whatever we get
     hints.ai_socktype = SOCK_STREAM;  // TCP
     hints.ai_protocol = 0;  // always use 0. this is coulped with family
 
     if ((status = getaddrinfo(server, port, &hints, &res)) != 0) {
         fprintf(stderr, "getaddrinfo failed with code: %s\n", gai_strerror(status));
-        return status;
+        return -1;
     }
 
-    // now iteratively try to create a socket and connect it to the server
-    for (p = &res[0]; p != NULL; p = p->ai_next) {
-        tries++;
-        //                     domain=IPv4  type=socktype    protocol=default this
-        if ((socketfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) < 0) {
-            // socket creation failed
-            continue;
-        }
-        if (connect(socketfd, p->ai_addr, p->ai_addrlen) == 0) {
-            // success! break
-            break;
-        }
-    }
+    fd = happy_eyeballs_connect(res, &tries);
+    freeaddrinfo(res);
 
-    if (p == NULL) {
+    if (fd == -1) {
         // couldn't connect to anything
-        fprintf(stderr, "unable to connect to any of %d returned addresses\n", tries);
-        return 2;
+        fprintf(stderr, "unable to connect to any of %d attempted addresses\n", tries);
+        return -1;
     }
+    *fresh = 1;
+    return fd;
+}
 
-    // hooray we are connected!
-    printf("We are live with socketfd %d!\n", socketfd);
+// receive one message into buf, null-terminated. Returns bytes received, 0 on close, -1 on error
+int recv_message(int socketfd, char *buf, int buf_size) {
+    int recvd_len;
+    if ((recvd_len = recv(socketfd, buf, buf_size - 1, 0)) == -1) {
+        fprintf(stderr, "Error recv: %s\n", strerror(errno));
+        buf[0] = '\0';
+        return -1;
+    }
+    buf[recvd_len] = '\0';  // ensure we null-terminate
+    return recvd_len;
+}
+
+/*
+One request: (on a fresh connection, wait for the greeting), send our message,
+read the echo. Returns 0 if the connection is still good for reuse, -1 otherwise.
+*/
+int do_request(int socketfd, int fresh, const char *message) {
+    int recv_buf_size = 100;
+    char recv_buf[recv_buf_size];
 
     // now that we've knocked, it's polite to wait for them to say hello
-    int recvd_len, recv_buf_size = 100;
-    char recv_buf[recv_buf_size];   
-    if ((recvd_len = recv(socketfd, recv_buf, recv_buf_size - 1, 0)) == -1) {
-        fprintf(stderr, "Error recv: %s\n", strerror(errno));
-    } else {
-        recv_buf[recvd_len] = '\0';  // ensure we null-terminate
+    if (fresh) {
+        if (recv_message(socketfd, recv_buf, recv_buf_size) <= 0) {
+            return -1;
+        }
+        printf("Server: %s\n", recv_buf);
     }
-    printf("Server: %s\n", recv_buf);
 
     // and now we tell them something and they yell it back at us (rude)
-    char *greeting = "wassup wit it";
-    if (send(socketfd, greeting, strlen(greeting), 0) == -1) {
+    if (send(socketfd, message, strlen(message), MSG_NOSIGNAL) == -1) {
         fprintf(stderr, "send failed: %s\n", strerror(errno));
+        return -1;
     }
-    printf("Us: %s\n", greeting);
+    printf("Us: %s\n", message);
 
-    if ((recvd_len = recv(socketfd, recv_buf, recv_buf_size - 1, 0)) == -1) {
-        fprintf(stderr, "Error recv: %s\n", strerror(errno));
-    } else {
-        recv_buf[recvd_len] = '\0';  // ensure we null-terminate
+    if (recv_message(socketfd, recv_buf, recv_buf_size) <= 0) {
+        return -1;
     }
     printf("Server: %s\n", recv_buf);
     return 0;
-}
\ No newline at end of file
+}
+
+int main(int argc, char *argv[]) {
+    // default server and client
+    const char *server = DEFAULT_SERVER;
+    // above, const applies to the data that server points to, not the pointer itself
+    // above, assigning a pointer to a character array like this is equivalent to = &DEFAULT_SERVER[0] (the array "decays" to a pointer)
+    const char *port = DEFAULT_PORT;
+    int requests = DEFAULT_REQUESTS;
+
+    // override defaults if user wants
+    if (argc > 4) {
+        fprintf(stderr, "usage: client [<server>] [<port>] [<requests>]\n");
+        fprintf(stderr, "defaults: %s, %s, %d\n", DEFAULT_SERVER, DEFAULT_PORT, DEFAULT_REQUESTS);
+        return 1;
+    }
+    if (argc >= 2) {
+        server = argv[1];  // custom server
+    }
+    if (argc >= 3) {
+        port = argv[2];  // custom port
+    }
+    if (argc == 4 && (requests = atoi(argv[3])) < 1) {
+        fprintf(stderr, "requests must be a positive integer\n");
+        return 1;
+    }
+
+    // print connection details
+    printf("Connecting to %s:%s\n", server, port);
+
+    conn_pool_t pool;
+    pool_init(&pool);
+    char pool_key[POOL_KEY_LEN];
+    snprintf(pool_key, sizeof(pool_key), "%s:%s", server, port);
+
+    char *greeting = "wassup wit it";
+    int succeeded = 0;
+    for (int i = 0; i < requests; i++) {
+        int fresh;
+        int socketfd = pool_connect(&pool, server, port, &fresh);
+        if (socketfd == -1) {
+            pool_close_all(&pool);
+            return 2;
+        }
+        if (fresh) {
+            // hooray we are connected!
+            printf("We are live with socketfd %d!\n", socketfd);
+        }
+
+        if (do_request(socketfd, fresh, greeting) == -1) {
+            close(socketfd);
+            if (fresh) {
+                continue;  // a brand new connection failing is a real error, not staleness
+            }
+            // a pooled connection can die between the liveness check and our send; retry once fresh
+            if ((socketfd = pool_connect(&pool, server, port, &fresh)) == -1) {
+                pool_close_all(&pool);
+                return 2;
+            }
+            if (do_request(socketfd, fresh, greeting) == -1) {
+                close(socketfd);
+                continue;
+            }
+        }
+        pool_put(&pool, pool_key, socketfd);
+        succeeded++;
+    }
+
+    pool_close_all(&pool);
+    if (succeeded == 0) {
+        fprintf(stderr, "all %d requests failed\n", requests);
+        return 2;
+    }
+    return 0;
+}
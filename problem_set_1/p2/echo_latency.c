@@ -0,0 +1,182 @@
+// compile with:  gcc echo_latency.c -o echo_latency -Wall -O2
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>  // TCP_NODELAY
+#include <netdb.h>
+
+/*
+Measures echo server round-trip latency: connects to each HOST:PORT given, sends
+fixed-size messages one at a time and times each until the whole reply is back.
+Several targets are measured one after another and printed as one table, so the
+default and busy-poll servers can be compared directly:
+
+    ./echo_server -p 8080 > /dev/null &
+    ./echo_server -p 8081 -b 1 &
+    ./echo_latency localhost:8080 localhost:8081
+
+With -s the client spins on its own socket too, which takes its wakeup latency out
+of the numbers and leaves mostly the server's.
+*/
+
+#define DEFAULT_ROUNDS 10000
+#define DEFAULT_WARMUP 1000
+#define DEFAULT_SIZE 32
+#define MAX_SIZE 99  // the echo server handles at most this much per recv
+
+double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+// connect to "host:port" (split at the last ':'). Returns the socket or -1
+int connect_target(const char *target) {
+    char host[256];
+    const char *colon = strrchr(target, ':');
+    struct addrinfo hints, *res, *p;
+    int fd = -1, yes = 1, status;
+
+    if (colon == NULL || colon - target >= (long) sizeof(host)) {
+        fprintf(stderr, "%s: expected HOST:PORT\n", target);
+        return -1;
+    }
+    memcpy(host, target, colon - target);
+    host[colon - target] = '\0';
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if ((status = getaddrinfo(host, colon + 1, &hints, &res)) != 0) {
+        fprintf(stderr, "%s: %s\n", target, gai_strerror(status));
+        return -1;
+    }
+    for (p = res; p != NULL; p = p->ai_next) {
+        if ((fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1) {
+            continue;
+        }
+        if (connect(fd, p->ai_addr, p->ai_addrlen) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd == -1) {
+        fprintf(stderr, "%s: cannot connect\n", target);
+        return -1;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));  // don't hold our small sends back
+    return fd;
+}
+
+// receive exactly len bytes; spin with MSG_DONTWAIT instead of sleeping if asked
+int recv_exact(int fd, char *buf, int len, int spin) {
+    int got = 0;
+    while (got < len) {
+        ssize_t n = recv(fd, buf + got, len - got, spin ? MSG_DONTWAIT : 0);
+        if (n > 0) {
+            got += n;
+        } else if (n == 0 || !(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// rounds timed round trips against target, after warmup untimed ones. Prints one row
+int measure(const char *target, int rounds, int warmup, int size, int spin) {
+    char msg[MAX_SIZE], reply[MAX_SIZE + 1];
+    double *samples = malloc(rounds * sizeof(double));
+    int fd = connect_target(target);
+
+    if (fd == -1 || samples == NULL) {
+        free(samples);
+        return -1;
+    }
+
+    // the server greets every new client first; take that off the wire
+    if (recv(fd, reply, sizeof(reply) - 1, 0) <= 0) {
+        fprintf(stderr, "%s: no greeting\n", target);
+        goto fail;
+    }
+
+    memset(msg, 'x', size);
+    for (int i = -warmup; i < rounds; i++) {
+        double start = now_us();
+        if (send(fd, msg, size, 0) != size || recv_exact(fd, reply, size, spin) == -1) {
+            fprintf(stderr, "%s: connection lost: %s\n", target, strerror(errno));
+            goto fail;
+        }
+        if (i >= 0) {
+            samples[i] = now_us() - start;
+        }
+    }
+    close(fd);
+
+    qsort(samples, rounds, sizeof(double), compare_doubles);
+    printf("%-24s %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f\n", target, samples[0],
+           samples[rounds / 2], samples[(int) (rounds * 0.9)], samples[(int) (rounds * 0.99)],
+           samples[(int) (rounds * 0.999)], samples[rounds - 1]);
+    free(samples);
+    return 0;
+
+fail:
+    close(fd);
+    free(samples);
+    return -1;
+}
+
+int main(int argc, char *argv[]) {
+    int rounds = DEFAULT_ROUNDS, warmup = DEFAULT_WARMUP, size = DEFAULT_SIZE;
+    int spin = 0, opt, failed = 0;
+
+    while ((opt = getopt(argc, argv, "n:w:m:s")) != -1) {
+        switch (opt) {
+        case 'n':
+            rounds = atoi(optarg);
+            break;
+        case 'w':
+            warmup = atoi(optarg);
+            break;
+        case 'm':
+            size = atoi(optarg);
+            break;
+        case 's':
+            spin = 1;
+            break;
+        default:
+            optind = argc;  // force the usage message
+            break;
+        }
+    }
+    if (optind >= argc || rounds < 1 || warmup < 0 || size < 1 || size > MAX_SIZE) {
+        printf("Usage: %s [-n rounds] [-w warmup] [-m message_size] [-s] HOST:PORT ...\n", argv[0]);
+        printf("  -n  timed round trips per target (default %d)\n", DEFAULT_ROUNDS);
+        printf("  -w  untimed round trips first (default %d)\n", DEFAULT_WARMUP);
+        printf("  -m  bytes per message, at most %d (default %d)\n", MAX_SIZE, DEFAULT_SIZE);
+        printf("  -s  spin on the client socket instead of blocking\n");
+        return 1;
+    }
+
+    printf("round-trip latency in microseconds, %d rounds of %d bytes%s\n", rounds, size,
+           spin ? ", client spinning" : "");
+    printf("%-24s %8s %8s %8s %8s %8s %8s\n", "target", "min", "p50", "p90", "p99",
+           "p99.9", "max");
+    for (int i = optind; i < argc; i++) {
+        if (measure(argv[i], rounds, warmup, size, spin) == -1) {
+            failed++;
+        }
+    }
+    return failed ? 1 : 0;
+}
@@ -1,3 +1,5 @@
+// compile with:  gcc echo_server.c -o echo_server -Wall -pthread
+#define _GNU_SOURCE  // CPU_SET, for pinning busy-poll threads
 #include <unistd.h>  // fork(), close()
 #include <stdio.h>
 #include <sys/socket.h>
@@ -10,6 +12,12 @@
 #include <sys/wait.h>  // WNOHANG, waitpid
 #include <arpa/inet.h>  // inet_ntop
 #include <ctype.h>  // toupper
+#include <fcntl.h>  // O_NONBLOCK
+#include <netinet/tcp.h>  // TCP_NODELAY, TCP_QUICKACK
+#include <pthread.h>
+#include <sched.h>  // sched_setaffinity
+#include <stdlib.h>  // atoi
+#include "../../trace/trace.h"  // build with -DTRACE_ENABLED ../../trace/trace.c to trace
 
 /*
 The Echo Protocol
@@ -27,6 +35,35 @@ And, as soon as the clients receives a response, it may close.
 #define DEFAULT_PORT "8080"  // convention for alternative http
 #define BACKLOG 10
 #define NELEMS(x)  (sizeof(x) / sizeof((x)[0]))  // do not use with pointers :)
+#define GREETING "Hey Baby Girl"
+#define RECV_BUF_SIZE 100
+
+/*
+Busy-poll mode (-b THREADS)
+The default server blocks in accept() and recv(). Every message then costs an
+interrupt, a wakeup and a trip through the scheduler before we even see it, which
+is tens of microseconds on a good day and much more in the tail.
+
+In busy-poll mode each thread is pinned to its own CPU and never sleeps: it spins
+over non-blocking sockets, so a message is picked up as soon as it lands. Each
+thread has its own listening socket on the same port (SO_REUSEPORT), and the kernel
+spreads incoming connections over them, so threads share nothing.
+- SO_BUSY_POLL / SO_PREFER_BUSY_POLL let recv() poll the NIC queue directly instead
+  of waiting for its interrupt (no effect on loopback, which has no NIC queue;
+  raising them may need CAP_NET_ADMIN, so failures only warn)
+- TCP_NODELAY sends replies at once instead of waiting to coalesce small writes
+- TCP_QUICKACK acks at once instead of delaying; the kernel can drop back to
+  delayed acks, so it is re-armed after every recv
+This trades CPU for latency: every busy thread uses 100% of its core, forever.
+Per-message logging is off in this mode; printing would cost more than the echo.
+*/
+#define BUSY_POLL_US 50  // how long recv() may poll the device queue
+#define MAX_BUSY_CLIENTS 64  // connections per busy-poll thread
+#define MAX_SEND_SPINS 100000  // EAGAINs in a row (~0.1s) before a client counts as stuck
+
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69  // linux 5.11+, missing from older headers
+#endif
 
 /*
 When a process exits/terminates, it's state remains on the process table entry
@@ -43,6 +80,13 @@ void sigchld_handler(int _unused) {
     errno = saved_errno;
 }
 
+// Ctrl-C stops accepting so the server can exit cleanly (and export its trace)
+volatile sig_atomic_t stop_requested = 0;
+
+void sigint_handler(int _unused) {
+    stop_requested = 1;
+}
+
 /*
 examines the incoming sockaddr, which is version-agnostic
 if IPv6, casts sa to a sockaddr_in6 pointer and returns a pointer to the sin6_addr attribute address
@@ -55,44 +99,47 @@ void *get_sin_addr_from_sockaddr(struct sockaddr *sa) {
     return &(((struct sockaddr_in *) sa)->sin_addr);
 }
 
-// convert a string to uppercase in-place
-void str_to_upper(char *str) {
-    char *c = str;
-    while (*c) {
-        *c = toupper((unsigned char) *c);
-        c++;
-    }
+// accept/recv/send wrapped in trace points, so a trace shows how long each one blocked
+int traced_accept(int socketfd, struct sockaddr *addr, socklen_t *addr_size) {
+    TRACE_BEGIN("accept");
+    int fd = accept(socketfd, addr, addr_size);
+    TRACE_END("accept");
+    return fd;
 }
 
-int main(int argc, char *argv[]) {
+ssize_t traced_recv(int fd, void *buf, size_t len) {
+    TRACE_BEGIN("recv");
+    ssize_t n = recv(fd, buf, len, 0);
+    TRACE_END("recv");
+    return n;
+}
 
-    // print connection details
-    printf("Preparing server on port: %s\n", DEFAULT_PORT);
+ssize_t traced_send(int fd, const void *buf, size_t len) {
+    TRACE_BEGIN("send");
+    ssize_t n = send(fd, buf, len, 0);
+    TRACE_END("send");
+    return n;
+}
 
-    // resolve server address
+/*
+resolve our own address on 'port' and bind a listening socket to it.
+With reuseport, several sockets (one per busy-poll thread) can bind the same port.
+Returns the socket, or -1 after printing why.
+*/
+int open_listener(const char *port, int reuseport) {
     struct addrinfo hints, *res, *p;
-    int status;
-    int socketfd, clientfd;
-    int tries = 0;
-    struct sigaction sa;  // used much later to reap forks
-    char ip_str_buffer[INET6_ADDRSTRLEN];  // buffer large enough to store string representation of IPv6
-
-    // servers need an extra, protocol(IP)-agnostic data structure to recieve
-    // the connecting client's address. It's literally just like a block of
-    // memory which is the same size as the greater of either sockaddr type
-    struct sockaddr_storage client_addr;
-    socklen_t addr_size = sizeof(client_addr);
+    int status, socketfd = -1;
+    int tries = 0, yes = 1;
 
-    
     memset(&hints, 0, sizeof(hints));
     hints.ai_family = AF_INET;  // IPv4
     hints.ai_socktype = SOCK_STREAM;  // TCP
     hints.ai_protocol = 0;  // always use 0. this is coulped with family
     hints.ai_flags = AI_PASSIVE;  // fill in my IP automatically
 
-    if ((status = getaddrinfo(NULL, DEFAULT_PORT, &hints, &res)) != 0) {
+    if ((status = getaddrinfo(NULL, port, &hints, &res)) != 0) {
         fprintf(stderr, "getaddrinfo failed with code: %s\n", gai_strerror(status));
-        return status;
+        return -1;
     }
 
     // now iteratively try to create a socket and bind to it
@@ -103,10 +150,15 @@ int main(int argc, char *argv[]) {
             // socket creation failed
             continue;
         }
+        if (reuseport && setsockopt(socketfd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) == -1) {
+            close(socketfd);
+            continue;
+        }
         if (bind(socketfd, p->ai_addr, p->ai_addrlen) == 0) {
             // success! break
             break;
         }
+        close(socketfd);
     }
 
     freeaddrinfo(res);
@@ -114,12 +166,291 @@ int main(int argc, char *argv[]) {
     if (p == NULL) {
         // couldn't bind to anything
         fprintf(stderr, "unable to bind to any of %d returned addresses\n", tries);
+        return -1;
+    }
+    if (listen(socketfd, BACKLOG) == -1) {
+        fprintf(stderr, "listen failed: %s\n", strerror(errno));
+        close(socketfd);
+        return -1;
+    }
+    return socketfd;
+}
+
+// convert a string to uppercase in-place
+void str_to_upper(char *str) {
+    char *c = str;
+    while (*c) {
+        *c = toupper((unsigned char) *c);
+        c++;
+    }
+}
+
+// low-latency socket options for busy-poll mode; failures only warn (see above)
+void tune_busy_socket(int fd, int is_listener) {
+    int yes = 1, busy_us = BUSY_POLL_US;
+    static int warned = 0;
+
+    if ((setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &busy_us, sizeof(busy_us)) == -1 ||
+            setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &yes, sizeof(yes)) == -1) &&
+            !__atomic_exchange_n(&warned, 1, __ATOMIC_RELAXED)) {
+        fprintf(stderr, "warning: SO_BUSY_POLL/SO_PREFER_BUSY_POLL: %s\n", strerror(errno));
+    }
+    if (!is_listener) {
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+        setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &yes, sizeof(yes));
+    }
+}
+
+// add O_NONBLOCK to fd's existing status flags. Returns 0, or -1 on failure
+int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+// send all of buf on a non-blocking socket, spinning while the send buffer is full.
+// A client that stops reading would pin the whole thread (and every other client on it),
+// so give up after MAX_SEND_SPINS fruitless tries in a row, or once we are asked to stop.
+// Returns 0, or -1 and the caller drops the client
+int send_all_spin(int fd, const char *buf, size_t len) {
+    int spins = 0;
+
+    while (len > 0) {
+        ssize_t sent = send(fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent == -1) {
+            if ((errno == EAGAIN || errno == EWOULDBLOCK) &&
+                    ++spins < MAX_SEND_SPINS && !stop_requested) {
+                continue;
+            }
+            return -1;
+        }
+        spins = 0;
+        buf += sent;
+        len -= sent;
+    }
+    return 0;
+}
+
+typedef struct {
+    int index;  // thread number; also picks the CPU it is pinned to
+    int listenfd;  // this thread's own SO_REUSEPORT listener, non-blocking
+    pthread_t thread;
+    unsigned long connections;
+    unsigned long messages;
+} busy_worker_t;
+
+void *busy_poll_worker(void *args) {
+    busy_worker_t *worker = (busy_worker_t *) args;
+    int clients[MAX_BUSY_CLIENTS];
+    int n_clients = 0;
+    char recv_buf[RECV_BUF_SIZE];
+    cpu_set_t cpus, pin;
+
+    // pin to the index-th CPU we are allowed on, so the spinning never migrates
+    if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0) {
+        int seen = 0, want = worker->index % CPU_COUNT(&cpus);
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &cpus) && seen++ == want) {
+                CPU_ZERO(&pin);
+                CPU_SET(cpu, &pin);
+                sched_setaffinity(0, sizeof(pin), &pin);  // 0 = this thread
+                break;
+            }
+        }
+    }
+
+    int listenfd = worker->listenfd;
+
+    while (!stop_requested) {
+        // anyone new? accept() on a non-blocking socket returns -1/EAGAIN at once if not
+        if (n_clients < MAX_BUSY_CLIENTS) {
+            int fd = accept(listenfd, NULL, NULL);
+            if (fd != -1 && set_nonblocking(fd) == -1) {
+                fprintf(stderr, "fcntl O_NONBLOCK: %s\n", strerror(errno));
+                close(fd);
+            } else if (fd != -1) {
+                tune_busy_socket(fd, 0);
+                if (send_all_spin(fd, GREETING, strlen(GREETING)) == 0) {
+                    clients[n_clients++] = fd;
+                    worker->connections++;
+                } else {
+                    close(fd);
+                }
+            }
+        }
+
+        // then poll every connection once, echoing whatever has arrived
+        for (int i = 0; i < n_clients; i++) {
+            ssize_t recvd_len = recv(clients[i], recv_buf, RECV_BUF_SIZE - 1, MSG_DONTWAIT);
+
+            if (recvd_len > 0) {
+                int yes = 1;
+                setsockopt(clients[i], IPPROTO_TCP, TCP_QUICKACK, &yes, sizeof(yes));  // re-arm
+                recv_buf[recvd_len] = '\0';
+                str_to_upper(recv_buf);
+                if (send_all_spin(clients[i], recv_buf, recvd_len) == 0) {
+                    worker->messages++;
+                    continue;
+                }
+            } else if (recvd_len == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                continue;  // nothing yet
+            }
+
+            // hung up or failed: close and move the last connection into this slot
+            close(clients[i]);
+            clients[i--] = clients[--n_clients];
+        }
+    }
+
+    for (int i = 0; i < n_clients; i++) {
+        close(clients[i]);
+    }
+    close(listenfd);
+    return NULL;
+}
+
+// busy-poll mode: n_threads pinned, spinning threads share the port until Ctrl-C
+int run_busy_poll(const char *port, int n_threads) {
+    busy_worker_t workers[n_threads];
+    int started = 0;
+    sigset_t stop_signals, old_mask;
+
+    // open every listener up front, so a refused SO_REUSEPORT or a taken port
+    // fails the server at startup instead of leaving a thread with nothing to serve
+    for (int i = 0; i < n_threads; i++) {
+        memset(&workers[i], 0, sizeof(busy_worker_t));
+        workers[i].index = i;
+        workers[i].listenfd = open_listener(port, 1);
+        if (workers[i].listenfd != -1 && set_nonblocking(workers[i].listenfd) == -1) {
+            fprintf(stderr, "fcntl O_NONBLOCK: %s\n", strerror(errno));
+            close(workers[i].listenfd);
+            workers[i].listenfd = -1;
+        }
+        if (workers[i].listenfd == -1) {
+            while (i-- > 0) {
+                close(workers[i].listenfd);
+            }
+            return 2;
+        }
+        tune_busy_socket(workers[i].listenfd, 1);
+    }
+
+    // keep Ctrl-C away from the workers (they inherit this mask); main waits for it below
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, &old_mask);
+
+    printf("Busy-polling on port %s with %d pinned threads\n", port, n_threads);
+    for (; started < n_threads; started++) {
+        if (pthread_create(&workers[started].thread, NULL, &busy_poll_worker, &workers[started]) != 0) {
+            break;
+        }
+    }
+    for (int i = started; i < n_threads; i++) {
+        close(workers[i].listenfd);  // no thread to serve it
+    }
+    if (started == 0) {
+        return 1;
+    }
+    fflush(stdout);
+
+    while (!stop_requested) {
+        sigsuspend(&old_mask);  // unblock and sleep in one step; the handler sets stop_requested
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+        printf("Thread %d: %lu connections, %lu messages\n", i,
+               workers[i].connections, workers[i].messages);
+    }
+    return 0;
+}
+
+/*
+Wait for the client to talk and yell it back upper-cased. Keeps echoing until they hang
+up, so a client can reuse one connection for many requests instead of reconnecting each
+time. verbose prints every exchange (the forking server does, the benchmark doesn't).
+Returns 0 when the client hung up, -1 on a recv/send error.
+*/
+int echo_loop(int clientfd, int verbose) {
+    int recvd_len, recv_buf_size = RECV_BUF_SIZE;
+    char recv_buf[recv_buf_size];
+
+    while ((recvd_len = traced_recv(clientfd, recv_buf, recv_buf_size - 1)) > 0) {
+        recv_buf[recvd_len] = '\0';  // ensure we null-terminate
+        if (verbose) {
+            printf("Client: %s\n", recv_buf);
+        }
+
+        // and now we tell them something and they yell it back at us (rude)
+        str_to_upper(recv_buf);  // no need to make a pointer, since this is already an array
+        if (traced_send(clientfd, recv_buf, recvd_len) == -1) {
+            fprintf(stderr, "send failed: %s\n", strerror(errno));
+            return -1;
+        }
+        if (verbose) {
+            printf("Us: %s\n", recv_buf);
+        }
+    }
+    if (recvd_len == -1) {
+        fprintf(stderr, "Error recv: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+#ifndef ECHO_SERVER_NO_MAIN
+int main(int argc, char *argv[]) {
+    const char *port = DEFAULT_PORT;
+    int busy_threads = 0;  // 0 = default mode: blocking accept, fork per client
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:b:")) != -1) {
+        switch (opt) {
+        case 'p':
+            port = optarg;
+            break;
+        case 'b':
+            busy_threads = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-p port] [-b busy_poll_threads]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    // print connection details
+    printf("Preparing server on port: %s\n", port);
+
+    int socketfd, clientfd;
+    struct sigaction sa;  // used much later to reap forks
+    char ip_str_buffer[INET6_ADDRSTRLEN];  // buffer large enough to store string representation of IPv6
+
+    // servers need an extra, protocol(IP)-agnostic data structure to recieve
+    // the connecting client's address. It's literally just like a block of
+    // memory which is the same size as the greater of either sockaddr type
+    struct sockaddr_storage client_addr;
+    socklen_t addr_size = sizeof(client_addr);
+
+    // no SA_RESTART: accept() must return so the loop can see the request
+    sigemptyset(&sa.sa_mask);
+    sa.sa_handler = sigint_handler;
+    sa.sa_flags = 0;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    if (busy_threads > 0) {
+        return run_busy_poll(port, busy_threads);
+    }
+
+    if ((socketfd = open_listener(port, 0)) == -1) {
         return 2;
     }
 
     // hooray we are connected!
     printf("We are are bound to socket %d! Listening...\n", socketfd);
-    listen(socketfd, BACKLOG);
 
     // set up sigaction to reap zombie processes
     sa.sa_handler = sigchld_handler;
@@ -131,8 +462,11 @@ int main(int argc, char *argv[]) {
     }
 
     // Accept incoming connections
-    while (1) {
-        if ((clientfd = accept(socketfd, (struct sockaddr*) &client_addr, &addr_size)) == -1) {
+    while (!stop_requested) {
+        if ((clientfd = traced_accept(socketfd, (struct sockaddr*) &client_addr, &addr_size)) == -1) {
+            if (errno == EINTR) {
+                continue;  // Ctrl-C (loop ends) or a signal we can ignore
+            }
             fprintf(stderr, "failed to accept connection: %s\n", strerror(errno));
             return 4;
         }
@@ -145,31 +479,23 @@ int main(int argc, char *argv[]) {
 
         if (!fork()) {  // child process
             close(socketfd);  // closes the file for the child. Does not delete it - parent can still listen!
-            char *greeting = "Hey Baby Girl";
-            if (send(clientfd, greeting, strlen(greeting), 0) == -1) {
+            char *greeting = GREETING;
+            if (traced_send(clientfd, greeting, strlen(greeting)) == -1) {
                 fprintf(stderr, "send failed: %s\n", strerror(errno));
             }  // TODO: confirm that the value returned by send is the size of the buffer. Else have to send more
             printf("We greeted our visiting client\n");
 
-            // wait for them to respond
-            int recvd_len, recv_buf_size = 100;
-            char recv_buf[recv_buf_size];   
-
-            if ((recvd_len = recv(clientfd, recv_buf, recv_buf_size - 1, 0)) == -1) {
-                fprintf(stderr, "Error recv: %s\n", strerror(errno));
-            } else {
-                recv_buf[recvd_len] = '\0';  // ensure we null-terminate
-            }
-            printf("Client: %s\n", recv_buf);
-
-            // and now we tell them something and they yell it back at us (rude)
-            str_to_upper(recv_buf);  // no need to make a pointer, since this is already an array
-            if (send(clientfd, recv_buf, recvd_len, 0) == -1) {
-                fprintf(stderr, "send failed: %s\n", strerror(errno));
-            }
-            printf("Us: %s\n", recv_buf);
+            echo_loop(clientfd, 1);
+            close(clientfd);
+            TRACE_EXPORT();  // each child appends its own events to the trace file
             return 0;
         }
+        close(clientfd);  // the child owns the connection now; keeping it open here would stop it ever closing
     }
+
+    printf("Shutting down\n");
+    close(socketfd);
+    TRACE_EXPORT();
     return 0;
-}
\ No newline at end of file
+}
+#endif
@@ -100,6 +100,7 @@ Both node/service and ai_flags	        Resolved addresses with additional query
 */
 
 
+// compile with:  gcc showip.c -o showip -Wall -pthread
 #include <stdlib.h>
 #include <stdio.h>
 #include <sys/types.h>
@@ -108,32 +109,545 @@ Both node/service and ai_flags	        Resolved addresses with additional query
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <string.h>
+#include <ctype.h>  // isspace
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>  // getopt
 
+/*
+BATCH MODE
+    showip -b [-f names.txt] [-j max_in_flight] [-t ttl_seconds] [-H hosts_file]
+
+Reads one hostname per line (from -f, or stdin) and resolves them concurrently on a
+pool of resolver threads. getaddrinfo blocks, so the number of worker threads IS the
+number of lookups in flight; the queue between the reader and the workers is bounded
+too, so a huge input file never turns into a huge backlog in memory.
+
+Every name goes through a TTL cache before it is queued: a name that is already being
+resolved, or was resolved less than ttl seconds ago, is counted as a duplicate and not
+looked up (or printed) again. Results are printed as soon as each lookup finishes, so
+output order is completion order, not input order:
+    <name>\tIPv4: a.b.c.d\tIPv6: ...
+    <name>\tERROR: <reason>
+
+-H resolves against a hosts(5)-format file instead of the system resolver, which makes
+batch runs reproducible offline (e.g. -H /etc/hosts, or a fixture file).
+*/
+
+#define DEFAULT_IN_FLIGHT 32
+#define DEFAULT_TTL_S 300
+#define MAX_NAME_LEN 256  // DNS names are at most 253 chars
+#define RESULT_LEN 1024  // one formatted output line
+#define CACHE_BUCKETS 65536  // power of 2, sized for tens of thousands of names
+
+typedef struct {
+    int max_in_flight;  // resolver threads == lookups in flight
+    int ttl_s;  // how long a resolved name is considered fresh
+    const char *hosts_file;  // NULL = use getaddrinfo
+} batch_opts_t;
+
+typedef struct {
+    long names;  // non-empty input lines
+    long resolved;
+    long failed;
+    long duplicates;  // served by the cache instead of a lookup
+} batch_stats_t;
+
+/*
+TTL cache entry. A name is "pending" from the moment it is queued until a worker
+finishes it; expires_at is only meaningful once it is done.
+*/
+typedef struct cache_entry {
+    struct cache_entry *next;  // bucket chain
+    int pending;
+    time_t expires_at;
+    char name[];  // flexible array member, allocated with the entry
+} cache_entry_t;
+
+typedef struct {
+    cache_entry_t *buckets[CACHE_BUCKETS];
+    pthread_mutex_t lock;
+} ttl_cache_t;
+
+/*
+hosts-file backend: name -> pre-formatted address list ("\tIPv4: ...\tIPv6: ...")
+Built once before the workers start and only read afterwards, so no lock.
+*/
+typedef struct hosts_entry {
+    struct hosts_entry *next;
+    char addrs[RESULT_LEN];
+    char name[];
+} hosts_entry_t;
+
+typedef struct {
+    hosts_entry_t *buckets[CACHE_BUCKETS];
+} hosts_table_t;
+
+/*
+Bounded queue of names between the reader and the resolver threads.
+Same lock + condition variable pattern as the reader/writer problem: wait while the
+predicate is false, update, signal the other side.
+*/
+typedef struct {
+    cache_entry_t **items;  // ring buffer; the entry's name is what gets resolved
+    int capacity, head, count;
+    int closed;  // set once input is exhausted; workers exit when it is also empty
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} name_queue_t;
+
+typedef struct {
+    const batch_opts_t *opts;
+    ttl_cache_t *cache;
+    hosts_table_t *hosts;  // NULL unless -H
+    name_queue_t *queue;
+    FILE *out;
+    pthread_mutex_t out_lock;  // one whole line at a time
+    batch_stats_t *stats;  // resolved/failed are updated under out_lock
+} batch_ctx_t;
+
+
+// FNV-1a, good enough to spread hostnames over buckets
+unsigned long hash_name(const char *s) {
+    unsigned long h = 14695981039346656037UL;
+    while (*s) {
+        h ^= (unsigned char) tolower((unsigned char) *s++);  // DNS names are case-insensitive
+        h *= 1099511628211UL;
+    }
+    return h & (CACHE_BUCKETS - 1);
+}
+
+/*
+Append "\tIPv4: x" / "\tIPv6: x" for every address in the list to buf.
+This is the same walk the single-name mode prints, just onto one line.
+*/
+void format_addrinfo(struct addrinfo *servinfo, char *buf, size_t buf_size) {
+    char ipstr[INET6_ADDRSTRLEN];
+    size_t used = strlen(buf);
+
+    for (struct addrinfo *p = servinfo; p != NULL && used < buf_size; p = p->ai_next) {
+        void *addr;
+        char *ipver;
+        if (p->ai_family == AF_INET) {  // IPv4
+            addr = &(((struct sockaddr_in *) p->ai_addr)->sin_addr);
+            ipver = "IPv4";
+        } else {  // IPv6
+            addr = &(((struct sockaddr_in6 *) p->ai_addr)->sin6_addr);
+            ipver = "IPv6";
+        }
+        inet_ntop(p->ai_family, addr, ipstr, sizeof(ipstr));
+        used += snprintf(buf + used, buf_size - used, "\t%s: %s", ipver, ipstr);
+    }
+}
+
+/*
+Load a hosts(5) file: "<address> <name> [<alias> ...]" with # comments.
+Returns NULL (with errno set) if the file can't be opened.
+*/
+hosts_table_t *hosts_load(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return NULL;
+    }
+    hosts_table_t *table = calloc(1, sizeof(hosts_table_t));
+    char *line = NULL;  // getline grows this for us, alias lists can be long
+    size_t line_size = 0;
+    unsigned char addr_bytes[sizeof(struct in6_addr)];
+
+    while (table != NULL && getline(&line, &line_size, f) != -1) {
+        char *hash = strchr(line, '#');
+        if (hash) {
+            *hash = '\0';
+        }
+        char *save;
+        char *addr = strtok_r(line, " \t\r\n", &save);
+        if (addr == NULL) {
+            continue;
+        }
+        char *ipver;
+        if (inet_pton(AF_INET, addr, addr_bytes) == 1) {
+            ipver = "IPv4";
+        } else if (inet_pton(AF_INET6, addr, addr_bytes) == 1) {
+            ipver = "IPv6";
+        } else {
+            continue;  // not an address, skip the malformed line
+        }
+
+        for (char *name = strtok_r(NULL, " \t\r\n", &save); name; name = strtok_r(NULL, " \t\r\n", &save)) {
+            unsigned long b = hash_name(name);
+            hosts_entry_t *e = table->buckets[b];
+            while (e && strcasecmp(e->name, name) != 0) {
+                e = e->next;
+            }
+            if (e == NULL) {  // first time we see this name
+                if ((e = calloc(1, sizeof(hosts_entry_t) + strlen(name) + 1)) == NULL) {
+                    continue;
+                }
+                strcpy(e->name, name);
+                e->next = table->buckets[b];
+                table->buckets[b] = e;
+            }
+            size_t used = strlen(e->addrs);
+            snprintf(e->addrs + used, sizeof(e->addrs) - used, "\t%s: %s", ipver, addr);
+        }
+    }
+    free(line);
+    fclose(f);
+    return table;
+}
+
+void hosts_free(hosts_table_t *table) {
+    if (table == NULL) {
+        return;
+    }
+    for (int b = 0; b < CACHE_BUCKETS; b++) {
+        hosts_entry_t *e = table->buckets[b];
+        while (e) {
+            hosts_entry_t *next = e->next;
+            free(e);
+            e = next;
+        }
+    }
+    free(table);
+}
+
+/*
+Resolve one name into a full output line in buf.
+Returns 0 on success, -1 if the name didn't resolve (buf then holds the error line).
+*/
+int resolve_name(batch_ctx_t *ctx, const char *name, char *buf, size_t buf_size) {
+    snprintf(buf, buf_size, "%s", name);
+
+    if (ctx->hosts != NULL) {
+        hosts_entry_t *e = ctx->hosts->buckets[hash_name(name)];
+        while (e && strcasecmp(e->name, name) != 0) {
+            e = e->next;
+        }
+        if (e == NULL) {
+            snprintf(buf, buf_size, "%s\tERROR: not in hosts file", name);
+            return -1;
+        }
+        snprintf(buf, buf_size, "%s%s", name, e->addrs);
+        return 0;
+    }
+
+    struct addrinfo hints, *servinfo;
+    int status;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC; // dont care if IPv4 or IPv6
+    hints.ai_socktype = SOCK_STREAM; // TCP, so each address only shows up once
+
+    if ((status = getaddrinfo(name, NULL, &hints, &servinfo)) != 0) {
+        snprintf(buf, buf_size, "%s\tERROR: %s", name, gai_strerror(status));
+        return -1;
+    }
+    format_addrinfo(servinfo, buf, buf_size);
+    freeaddrinfo(servinfo);
+    return 0;
+}
+
+/*
+Decide whether name needs a lookup. Returns 1 and sets *claimed to the (pending)
+cache entry to queue, 0 if it is a duplicate: already in flight, or resolved and
+not yet expired, or -1 if there was no memory for a new entry.
+Expired entries are reused in place rather than reallocated.
+*/
+int cache_claim(ttl_cache_t *cache, const char *name, time_t now, cache_entry_t **claimed) {
+    unsigned long b = hash_name(name);
+    cache_entry_t *e;
+
+    pthread_mutex_lock(&cache->lock);
+    for (e = cache->buckets[b]; e != NULL; e = e->next) {
+        if (strcasecmp(e->name, name) == 0) {
+            break;
+        }
+    }
+    if (e != NULL && (e->pending || now < e->expires_at)) {
+        pthread_mutex_unlock(&cache->lock);
+        return 0;  // cache hit
+    }
+    if (e == NULL && (e = malloc(sizeof(cache_entry_t) + strlen(name) + 1)) != NULL) {
+        strcpy(e->name, name);
+        e->next = cache->buckets[b];
+        cache->buckets[b] = e;
+    }
+    if (e != NULL) {
+        e->pending = 1;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    *claimed = e;
+    return e != NULL ? 1 : -1;
+}
+
+void cache_finish(ttl_cache_t *cache, cache_entry_t *e, int ttl_s) {
+    pthread_mutex_lock(&cache->lock);
+    e->pending = 0;
+    e->expires_at = time(NULL) + ttl_s;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void cache_free(ttl_cache_t *cache) {
+    for (int b = 0; b < CACHE_BUCKETS; b++) {
+        cache_entry_t *e = cache->buckets[b];
+        while (e) {
+            cache_entry_t *next = e->next;
+            free(e);
+            e = next;
+        }
+    }
+}
+
+// blocks while the queue is full, which is what bounds the backlog
+void queue_push(name_queue_t *q, cache_entry_t *e) {
+    pthread_mutex_lock(&q->lock);
+    while (q->count == q->capacity) {
+        pthread_cond_wait(&q->not_full, &q->lock);
+    }
+    q->items[(q->head + q->count) % q->capacity] = e;
+    q->count++;
+    pthread_mutex_unlock(&q->lock);
+    pthread_cond_signal(&q->not_empty);
+}
+
+// returns NULL once the queue is closed and drained
+cache_entry_t *queue_pop(name_queue_t *q) {
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0 && !q->closed) {
+        pthread_cond_wait(&q->not_empty, &q->lock);
+    }
+    cache_entry_t *e = NULL;
+    if (q->count > 0) {
+        e = q->items[q->head];
+        q->head = (q->head + 1) % q->capacity;
+        q->count--;
+    }
+    pthread_mutex_unlock(&q->lock);
+    if (e != NULL) {
+        pthread_cond_signal(&q->not_full);
+    }
+    return e;
+}
+
+void queue_close(name_queue_t *q) {
+    pthread_mutex_lock(&q->lock);
+    q->closed = 1;
+    pthread_mutex_unlock(&q->lock);
+    pthread_cond_broadcast(&q->not_empty);
+}
+
+void *resolver_worker(void *args) {
+    batch_ctx_t *ctx = (batch_ctx_t *) args;
+    char line[RESULT_LEN];
+    cache_entry_t *e;
+
+    while ((e = queue_pop(ctx->queue)) != NULL) {
+        int rc = resolve_name(ctx, e->name, line, sizeof(line));
+
+        // stream the result out as soon as it's ready
+        pthread_mutex_lock(&ctx->out_lock);
+        fprintf(ctx->out, "%s\n", line);
+        if (rc == 0) {
+            ctx->stats->resolved++;
+        } else {
+            ctx->stats->failed++;
+        }
+        pthread_mutex_unlock(&ctx->out_lock);
+
+        cache_finish(ctx->cache, e, ctx->opts->ttl_s);
+    }
+    return NULL;
+}
+
+// a name the reader rejected without a lookup still gets its line and counts as failed
+void report_rejected(batch_ctx_t *ctx, const char *name, const char *why) {
+    pthread_mutex_lock(&ctx->out_lock);
+    fprintf(ctx->out, "%s\tERROR: %s\n", name, why);
+    ctx->stats->failed++;
+    pthread_mutex_unlock(&ctx->out_lock);
+}
+
+// strip leading/trailing whitespace in place, returns the start of the trimmed string
+char *trim(char *s) {
+    while (isspace((unsigned char) *s)) {
+        s++;
+    }
+    char *end = s + strlen(s);
+    while (end > s && isspace((unsigned char) end[-1])) {
+        *--end = '\0';
+    }
+    return s;
+}
+
+/*
+Resolve every name read from in, writing one line per unique name to out.
+Returns 0 on success, non-zero if the batch couldn't be set up.
+*/
+int run_batch(FILE *in, FILE *out, const batch_opts_t *opts, batch_stats_t *stats) {
+    int workers = opts->max_in_flight;
+    int rc = 0;
+    batch_ctx_t ctx;
+    name_queue_t queue;
+    ttl_cache_t *cache = calloc(1, sizeof(ttl_cache_t));  // 512KB of buckets, too big for the stack
+    pthread_t *threads = calloc(workers, sizeof(pthread_t));
+
+    memset(stats, 0, sizeof(*stats));
+    memset(&queue, 0, sizeof(queue));
+    queue.capacity = 2 * workers;  // enough to keep every worker busy, no more
+    queue.items = calloc(queue.capacity, sizeof(cache_entry_t *));
+    if (cache == NULL || threads == NULL || queue.items == NULL) {
+        free(cache);
+        free(threads);
+        free(queue.items);
+        return 1;
+    }
+    pthread_mutex_init(&cache->lock, NULL);
+    pthread_mutex_init(&queue.lock, NULL);
+    pthread_cond_init(&queue.not_empty, NULL);
+    pthread_cond_init(&queue.not_full, NULL);
+
+    ctx.opts = opts;
+    ctx.cache = cache;
+    ctx.queue = &queue;
+    ctx.out = out;
+    ctx.stats = stats;
+    ctx.hosts = NULL;
+    pthread_mutex_init(&ctx.out_lock, NULL);
+    if (opts->hosts_file != NULL && (ctx.hosts = hosts_load(opts->hosts_file)) == NULL) {
+        fprintf(stderr, "cannot read hosts file '%s': %s\n", opts->hosts_file, strerror(errno));
+        rc = 2;
+        goto cleanup;
+    }
+
+    int started = 0;
+    for (; started < workers; started++) {
+        if (pthread_create(&threads[started], NULL, &resolver_worker, &ctx) != 0) {
+            break;
+        }
+    }
+    if (started == 0) {
+        rc = 3;
+        goto cleanup;
+    }
+
+    // reader: dedupe through the cache, queue the rest. Blocks when workers fall behind
+    char line[MAX_NAME_LEN + 2];
+    while (fgets(line, sizeof(line), in) != NULL) {
+        if (strchr(line, '\n') == NULL && !feof(in)) {
+            // longer than any DNS name: swallow the rest so it counts as one bad name, not several
+            int c;
+            while ((c = fgetc(in)) != EOF && c != '\n') {
+            }
+            stats->names++;
+            line[32] = '\0';  // a prefix is enough to recognise it in the output
+            report_rejected(&ctx, trim(line), "name too long");
+            continue;
+        }
+        char *name = trim(line);
+        if (*name == '\0' || *name == '#') {
+            continue;
+        }
+        stats->names++;
+        cache_entry_t *e;
+        int claimed = cache_claim(cache, name, time(NULL), &e);
+        if (claimed == 0) {
+            stats->duplicates++;  // only the reader touches this one
+            continue;
+        }
+        if (claimed == -1) {
+            report_rejected(&ctx, name, "out of memory");
+            continue;
+        }
+        queue_push(&queue, e);
+    }
+
+    queue_close(&queue);
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+cleanup:
+    hosts_free(ctx.hosts);
+    cache_free(cache);
+    free(cache);
+    free(threads);
+    free(queue.items);
+    return rc;
+}
+
+#ifndef SHOWIP_NO_MAIN
 int main(int argc, char *argv[]) {
     // cast inputs to node address
     // char address_str[] = "www.example.com";
     // char port_str[] = "3490";
 
     struct addrinfo hints, *servinfo, *p;
-    int status;
+    int status, opt;
+    int batch = 0;
+    const char *names_file = NULL;
     char ipstr[INET6_ADDRSTRLEN];
+    batch_opts_t opts = { DEFAULT_IN_FLIGHT, DEFAULT_TTL_S, NULL };
+
+    while ((opt = getopt(argc, argv, "bf:j:t:H:")) != -1) {
+        switch (opt) {
+        case 'b': batch = 1; break;
+        case 'f': names_file = optarg; break;
+        case 'j': opts.max_in_flight = atoi(optarg); break;
+        case 't': opts.ttl_s = atoi(optarg); break;
+        case 'H': opts.hosts_file = optarg; break;
+        default: batch = -1; break;
+        }
+    }
+
+    if (batch == 1) {
+        if (optind != argc || opts.max_in_flight < 1 || opts.ttl_s < 0) {
+            fprintf(stderr, "usage: main -b [-f names_file] [-j max_in_flight] [-t ttl_s] [-H hosts_file]\n");
+            return 1;
+        }
+        FILE *in = stdin;
+        if (names_file != NULL && strcmp(names_file, "-") != 0 && (in = fopen(names_file, "r")) == NULL) {
+            fprintf(stderr, "cannot open '%s': %s\n", names_file, strerror(errno));
+            return 1;
+        }
+
+        batch_stats_t stats;
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        int rc = run_batch(in, stdout, &opts, &stats);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        if (in != stdin) {
+            fclose(in);
+        }
+        if (rc != 0) {
+            return 2;
+        }
+
+        double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        fprintf(stderr, "%ld names: %ld resolved, %ld failed, %ld duplicates in %.3fs (%.0f lookups/s)\n",
+            stats.names, stats.resolved, stats.failed, stats.duplicates, secs,
+            secs > 0 ? (stats.resolved + stats.failed) / secs : 0.0);
+        return 0;
+    }
 
-    if (argc != 2) {
+    if (batch != 0 || argc - optind != 1) {
         fprintf(stderr, "usage: main <hostname>\n");
+        fprintf(stderr, "       main -b [-f names_file] [-j max_in_flight] [-t ttl_s] [-H hosts_file]\n");
         return 1;
     }
+    const char *hostname = argv[optind];
 
     memset(&hints, 0, sizeof(hints));
     hints.ai_family = AF_UNSPEC; // dont care if IPv4 or IPv6
     hints.ai_socktype = SOCK_STREAM; // TCP
     // hints.ai_flags = AI_PASSVE; // fills in my IP - not needed for client, only server
 
-    if ((status = getaddrinfo(argv[1], NULL, &hints, &servinfo)) != 0) {  // we are not specifying a port/service. Why not?
+    if ((status = getaddrinfo(hostname, NULL, &hints, &servinfo)) != 0) {  // we are not specifying a port/service. Why not?
         fprintf(stderr, "getaddrinfo failed: %s\n", gai_strerror(status));
         return 2;
     }
     // serveinfo now points to a linked list of 1 or more struct addrinfos
-    printf("IP addresses for %s:\n\n", argv[1]);
+    printf("IP addresses for %s:\n\n", hostname);
 
     // iterate through result addresses
     for (p = servinfo; p != NULL; p = p->ai_next) {
@@ -158,4 +672,5 @@ int main(int argc, char *argv[]) {
     }
     freeaddrinfo(servinfo);
     return 0;
-}
\ No newline at end of file
+}
+#endif
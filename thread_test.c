@@ -1,8 +1,121 @@
-// compile with:  gcc thread_test.c -o thread_test -Wall -pthread
+// compile with:  gcc thread_test.c -o thread_test -O3 -Wall -pthread
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
 #include <pthread.h>
 #include <time.h>
+#include <unistd.h>
+
+// rand() keeps one hidden state for the whole process behind a lock, so threads
+// that roll dice with it take turns. Each thread gets its own generator instead:
+// xoshiro256**, run as RNG_LANES independent streams side by side so the loop
+// that advances them has no dependency between lanes and the compiler can turn
+// it into SIMD instructions.
+#define RNG_LANES 8
+
+typedef struct
+{
+    uint64_t s[4][RNG_LANES];  // state word k of every lane is contiguous
+    uint64_t out[RNG_LANES];   // outputs of the last step, handed out one by one
+    int pos;                   // next unused entry of out
+} rng_t;
+
+static inline uint64_t rotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+// splitmix64: turns one seed into well-mixed words to fill the xoshiro state
+static uint64_t splitmix64(uint64_t *x) {
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+void rng_seed(rng_t *rng, uint64_t seed) {
+    for (int lane = 0; lane < RNG_LANES; lane++) {
+        for (int k = 0; k < 4; k++) {
+            rng->s[k][lane] = splitmix64(&seed);
+        }
+    }
+    rng->pos = RNG_LANES;  // nothing buffered yet
+}
+
+// advance every lane one step, writing one output per lane
+static inline void rng_step(rng_t *rng, uint64_t *out) {
+    uint64_t *s0 = rng->s[0], *s1 = rng->s[1], *s2 = rng->s[2], *s3 = rng->s[3];
+
+    for (int lane = 0; lane < RNG_LANES; lane++) {
+        uint64_t t = s1[lane] << 17;
+        out[lane] = rotl(s1[lane] * 5, 7) * 9;
+        s2[lane] ^= s0[lane];
+        s3[lane] ^= s1[lane];
+        s1[lane] ^= s2[lane];
+        s0[lane] ^= s3[lane];
+        s2[lane] ^= t;
+        s3[lane] = rotl(s3[lane], 45);
+    }
+}
+
+uint64_t rng_next(rng_t *rng) {
+    if (rng->pos == RNG_LANES) {
+        rng_step(rng, rng->out);
+        rng->pos = 0;
+    }
+    return rng->out[rng->pos++];
+}
+
+// Lemire's multiply-shift: maps a 32-bit random x onto [0, range) as the high half
+// of x * range. The low half tells us when x fell in the few values that would
+// make some results more likely than others; those are thrown away and redrawn,
+// which keeps rolls exactly uniform. For a die that is about 1 draw in 700 million,
+// and the division to find the cutoff only happens in that rare case.
+static inline uint32_t bounded(rng_t *rng, uint32_t x, uint32_t range) {
+    uint64_t m = (uint64_t) x * range;
+    uint32_t low = (uint32_t) m;
+
+    if (low < range) {
+        uint32_t cutoff = -range % range;
+        while (low < cutoff) {
+            x = (uint32_t) rng_next(rng);
+            m = (uint64_t) x * range;
+            low = (uint32_t) m;
+        }
+    }
+    return m >> 32;
+}
+
+// fill rolls[0..n) with dice rolls in 1..sides. Every 64-bit output gives two rolls.
+void roll_dice_batch(rng_t *rng, int sides, uint32_t *rolls, size_t n) {
+    uint64_t block[RNG_LANES];
+    size_t i = 0;
+
+    while (n - i >= 2 * RNG_LANES) {
+        rng_step(rng, block);
+        for (int lane = 0; lane < RNG_LANES; lane++) {
+            rolls[i++] = bounded(rng, (uint32_t) block[lane], sides) + 1;
+            rolls[i++] = bounded(rng, (uint32_t) (block[lane] >> 32), sides) + 1;
+        }
+    }
+    while (i < n) {
+        rolls[i++] = bounded(rng, (uint32_t) rng_next(rng), sides) + 1;
+    }
+}
+
+// each thread seeds its own generator the first time it rolls
+static _Thread_local rng_t thread_rng;
+static _Thread_local int thread_rng_ready;
+static atomic_uint_fast64_t next_seed;
+
+static rng_t *my_rng(void) {
+    if (!thread_rng_ready) {
+        rng_seed(&thread_rng, atomic_fetch_add(&next_seed, 1));
+        thread_rng_ready = 1;
+    }
+    return &thread_rng;
+}
 
 typedef struct
 {
@@ -15,36 +128,368 @@ typedef struct
 } myret_t;
 
 
-void *roll_dice(void *args) {
+// Futures: instead of a thread per result and a malloc'd return value handed
+// back through pthread_join, tasks run on a fixed pool of threads and write their
+// result straight into a slot the caller owns. Each slot sits on its own cache
+// line, so threads finishing neighbouring tasks don't fight over it. The task
+// queue is a ring allocated once in pool_init(); submitting and completing
+// tasks allocates nothing.
+typedef struct
+{
+    atomic_int done;   // set once result is written
+    int taken;         // already handed out by future_wait_any(); caller's thread only
+    myret_t result;
+} __attribute__((aligned(64))) future_t;
+
+typedef void (*task_fn_t)(void *args, myret_t *result);
+
+typedef struct
+{
+    task_fn_t fn;
+    void *args;
+    future_t *future;
+} task_t;
+
+typedef struct
+{
+    pthread_t *threads;
+    int n_threads;
+
+    task_t *tasks;              // ring of queued tasks
+    size_t cap, head, count;
+    int closing;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+
+    atomic_int waiters;         // threads blocked in future_wait*()
+    pthread_mutex_t done_lock;
+    pthread_cond_t done_cond;
+} pool_t;
+
+void *pool_worker(void *args) {
+    pool_t *pool = (pool_t *) args;
+
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->count == 0 && !pool->closing) {
+            pthread_cond_wait(&pool->not_empty, &pool->lock);
+        }
+        if (pool->count == 0) {  // closing and drained
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        task_t task = pool->tasks[pool->head];
+        pool->head = (pool->head + 1) % pool->cap;
+        pool->count--;
+        pthread_cond_signal(&pool->not_full);
+        pthread_mutex_unlock(&pool->lock);
+
+        task.fn(task.args, &task.future->result);
+
+        // Publish, then wake waiters only if there are any. Both sides use
+        // sequentially consistent atomics: either we see the waiter's count, or
+        // the waiter sees done before it sleeps.
+        atomic_store(&task.future->done, 1);
+        if (atomic_load(&pool->waiters) > 0) {
+            pthread_mutex_lock(&pool->done_lock);
+            pthread_cond_broadcast(&pool->done_cond);
+            pthread_mutex_unlock(&pool->done_lock);
+        }
+    }
+}
+
+// start n_threads workers with room for queue_cap queued tasks. Returns 0 or -1.
+int pool_init(pool_t *pool, int n_threads, size_t queue_cap) {
+    memset(pool, 0, sizeof(*pool));
+    pool->tasks = malloc(queue_cap * sizeof(task_t));
+    pool->threads = malloc(n_threads * sizeof(pthread_t));
+    if (pool->tasks == NULL || pool->threads == NULL) {
+        free(pool->tasks);
+        free(pool->threads);
+        return -1;
+    }
+    pool->cap = queue_cap;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->not_empty, NULL);
+    pthread_cond_init(&pool->not_full, NULL);
+    pthread_mutex_init(&pool->done_lock, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+
+    for (; pool->n_threads < n_threads; pool->n_threads++) {
+        if (pthread_create(&pool->threads[pool->n_threads], NULL, &pool_worker, pool) != 0) {
+            break;
+        }
+    }
+    return pool->n_threads > 0 ? 0 : -1;
+}
+
+// finish every queued task, then stop the workers
+void pool_destroy(pool_t *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->closing = 1;
+    pthread_cond_broadcast(&pool->not_empty);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->n_threads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_cond_destroy(&pool->done_cond);
+    pthread_mutex_destroy(&pool->done_lock);
+    pthread_cond_destroy(&pool->not_full);
+    pthread_cond_destroy(&pool->not_empty);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->threads);
+    free(pool->tasks);
+}
+
+// queue fn(args, &future->result); blocks while the queue is full
+void pool_submit(pool_t *pool, task_fn_t fn, void *args, future_t *future) {
+    atomic_store_explicit(&future->done, 0, memory_order_relaxed);
+    future->taken = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->count == pool->cap) {
+        pthread_cond_wait(&pool->not_full, &pool->lock);
+    }
+    pool->tasks[(pool->head + pool->count) % pool->cap] = (task_t) { fn, args, future };
+    pool->count++;
+    pthread_cond_signal(&pool->not_empty);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static inline int future_ready(future_t *future) {
+    return atomic_load_explicit(&future->done, memory_order_acquire);
+}
+
+// Wait until one of futures[0..n) is done and return its index, skipping the
+// taken ones when skip_taken is set. Checks a few times before sleeping, since
+// short tasks often finish within that.
+static int wait_ready(pool_t *pool, future_t *futures, int n, int skip_taken) {
+    for (int spin = 0; spin < 64; spin++) {
+        for (int i = 0; i < n; i++) {
+            if (!(skip_taken && futures[i].taken) && future_ready(&futures[i])) {
+                return i;
+            }
+        }
+    }
+
+    atomic_fetch_add(&pool->waiters, 1);
+    pthread_mutex_lock(&pool->done_lock);
+    for (;;) {
+        for (int i = 0; i < n; i++) {
+            if (!(skip_taken && futures[i].taken) && atomic_load(&futures[i].done)) {
+                pthread_mutex_unlock(&pool->done_lock);
+                atomic_fetch_sub(&pool->waiters, 1);
+                return i;
+            }
+        }
+        pthread_cond_wait(&pool->done_cond, &pool->done_lock);
+    }
+}
+
+// Wait until one of futures[0..n) that hasn't been returned yet is done, mark it
+// taken and return its index, so calling it in a loop visits each result once,
+// in completion order. Returns -1 once every future has been taken;
+// pool_submit() makes a future eligible again.
+int future_wait_any(pool_t *pool, future_t *futures, int n) {
+    int i;
+
+    for (i = 0; i < n && futures[i].taken; i++) {
+    }
+    if (i == n) {
+        return -1;
+    }
+    i = wait_ready(pool, futures, n, 1);
+    futures[i].taken = 1;
+    return i;
+}
+
+// wait for this one future, whether or not future_wait_any() has returned it
+myret_t *future_wait(pool_t *pool, future_t *future) {
+    wait_ready(pool, future, 1, 0);
+    return &future->result;
+}
+
+void future_wait_all(pool_t *pool, future_t *futures, int n) {
+    for (int i = 0; i < n; i++) {
+        future_wait(pool, &futures[i]);
+    }
+}
+
+void roll_dice(void *args, myret_t *res_ptr) {
     myargs_t *myargs = (myargs_t *) args;  // cast args back to myargs struct
-    
-    myret_t *res_ptr = malloc(sizeof(myret_t));  // reserve space on heap for return because stack values will be wiped when thread returns
-    res_ptr->value = (rand() % myargs->sides) + 1;  // -> syntax dereferences for us
+    uint32_t roll;
+
+    // no malloc: the result goes straight into the caller's slot
+    roll_dice_batch(my_rng(), myargs->sides, &roll, 1);
+    res_ptr->value = roll;  // -> syntax dereferences for us
+}
+
+// Monte Carlo: roll 'dice' dice with 'sides' sides 'trials' times and count how
+// often each total comes up. Trials are split evenly across threads; each thread
+// rolls into a reused buffer and counts into its own histogram, so nothing is
+// allocated or shared per sample. The histograms are added up after the join.
+#define MC_MAX_DICE 16
+#define MC_MAX_SIDES 1024
+#define MC_BATCH 4096  // rolls per roll_dice_batch() call
+
+typedef struct
+{
+    rng_t rng;
+    uint64_t trials;
+    int dice;
+    int sides;
+    uint64_t *hist;  // dice * sides + 1 counters, this thread's own
+} __attribute__((aligned(64))) mc_worker_t;  // keep workers on separate cache lines
+
+void *mc_worker(void *args) {
+    mc_worker_t *w = (mc_worker_t *) args;
+    uint64_t per_batch = MC_BATCH / w->dice;
+    uint32_t rolls[MC_BATCH];
 
-    printf("Thread: return stored at %p\n", res_ptr);
+    for (uint64_t done = 0; done < w->trials; ) {
+        uint64_t n = w->trials - done < per_batch ? w->trials - done : per_batch;
 
-    return (void *) res_ptr;  // cast to void pointer in order to return
+        roll_dice_batch(&w->rng, w->sides, rolls, n * w->dice);
+        for (uint64_t t = 0; t < n; t++) {
+            uint32_t sum = 0;
+            for (int d = 0; d < w->dice; d++) {
+                sum += rolls[t * w->dice + d];
+            }
+            w->hist[sum]++;
+        }
+        done += n;
+    }
+    return NULL;
+}
+
+// Run the simulation on n_threads threads. hist must hold dice * sides + 1
+// counters; it receives the combined counts. Returns 0, or -1 on failure.
+int monte_carlo(uint64_t trials, int n_threads, int dice, int sides, uint64_t seed,
+                uint64_t *hist) {
+    size_t n_hist = (size_t) dice * sides + 1;
+    mc_worker_t *workers;
+    pthread_t *threads;
+    uint64_t *counts;
+    int started = 0, ret = 0;
+
+    workers = aligned_alloc(64, n_threads * sizeof(mc_worker_t));
+    threads = malloc(n_threads * sizeof(pthread_t));
+    // one histogram per thread, each rounded up to whole cache lines
+    size_t stride = (n_hist + 7) & ~(size_t) 7;
+    counts = aligned_alloc(64, n_threads * stride * sizeof(uint64_t));
+    if (workers == NULL || threads == NULL || counts == NULL) {
+        ret = -1;
+        goto out;
+    }
+    memset(counts, 0, n_threads * stride * sizeof(uint64_t));
+
+    for (int i = 0; i < n_threads; i++) {
+        mc_worker_t *w = &workers[i];
+        rng_seed(&w->rng, seed + i);  // seeds are mixed by splitmix64, so adjacent is fine
+        w->trials = trials / n_threads + ((uint64_t) i < trials % n_threads);
+        w->dice = dice;
+        w->sides = sides;
+        w->hist = counts + i * stride;
+        if (pthread_create(&threads[i], NULL, &mc_worker, w) != 0) {
+            ret = -1;
+            break;
+        }
+        started++;
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    memset(hist, 0, n_hist * sizeof(uint64_t));
+    for (int i = 0; i < started; i++) {
+        for (size_t s = 0; s < n_hist; s++) {
+            hist[s] += workers[i].hist[s];
+        }
+    }
+
+out:
+    free(counts);
+    free(threads);
+    free(workers);
+    return ret;
+}
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int run_monte_carlo(uint64_t trials, int n_threads, int dice, int sides) {
+    uint64_t *hist = malloc(((size_t) dice * sides + 1) * sizeof(uint64_t));
+    double start, elapsed;
+
+    start = now_s();
+    if (hist == NULL || monte_carlo(trials, n_threads, dice, sides, time(NULL), hist) != 0) {
+        fprintf(stderr, "monte_carlo failed\n");
+        free(hist);
+        return 1;
+    }
+    elapsed = now_s() - start;
+
+    printf("%dd%d, %llu trials on %d threads\n", dice, sides,
+           (unsigned long long) trials, n_threads);
+    for (int sum = dice; sum <= dice * sides; sum++) {
+        printf("%4d  %.6f\n", sum, (double) hist[sum] / trials);
+    }
+    printf("%.3f s, %.1f million rolls/s\n", elapsed,
+           trials * (double) dice / elapsed / 1e6);
+    free(hist);
+    return 0;
 }
 
 int main(int argc, char* argv[]) {
-    srand(time(NULL));  // set random seed
+    atomic_store(&next_seed, time(NULL));  // set random seed
 
-    pthread_t th;
-    myret_t *result_ptr;
-    int sides = 6;
+    // thread_test TRIALS [THREADS] [DICE] [SIDES]: run the Monte Carlo instead
+    if (argc > 1) {
+        uint64_t trials = strtoull(argv[1], NULL, 0);
+        int n_threads = argc > 2 ? atoi(argv[2]) : sysconf(_SC_NPROCESSORS_ONLN);
+        int dice = argc > 3 ? atoi(argv[3]) : 2;
+        int sides = argc > 4 ? atoi(argv[4]) : 6;
 
-    if (pthread_create(&th, NULL, &roll_dice, &sides) != 0) {
-        // failed to create thread
+        if (trials == 0 || n_threads < 1 || dice < 1 || dice > MC_MAX_DICE ||
+                sides < 1 || sides > MC_MAX_SIDES) {
+            printf("Usage: %s [TRIALS [THREADS [DICE [SIDES]]]]\n", argv[0]);
+            printf("  at most %d dice of at most %d sides\n", MC_MAX_DICE, MC_MAX_SIDES);
+            return 1;
+        }
+        return run_monte_carlo(trials, n_threads, dice, sides);
+    }
+
+    // roll a handful of dice on a pool of threads, results in preallocated slots
+    enum { N_ROLLS = 8 };
+    static future_t rolls[N_ROLLS];  // future_t is cache-line aligned
+    myargs_t args = { .sides = 6 };
+    pool_t pool;
+
+    if (pool_init(&pool, 4, N_ROLLS) != 0) {
+        // failed to create threads
         return 1;
     }
-    if (pthread_join(th, (void **) &result_ptr) != 0) {
-        // failed to join thread
-        return 2;
+    for (int i = 0; i < N_ROLLS; i++) {
+        pool_submit(&pool, &roll_dice, &args, &rolls[i]);
     }
 
-    printf("Main: return stored at %p\n", result_ptr);
-    printf("Main: diceroll was %d\n", result_ptr->value);
-    free(result_ptr);
+    // each result once, as it comes in
+    int i;
+    while ((i = future_wait_any(&pool, rolls, N_ROLLS)) != -1) {
+        printf("Main: roll %d finished: %d\n", i, rolls[i].result.value);
+    }
+
+    future_wait_all(&pool, rolls, N_ROLLS);
+    for (int i = 0; i < N_ROLLS; i++) {
+        printf("Main: roll %d stored at %p was %d\n", i, (void *) &rolls[i].result,
+               rolls[i].result.value);
+    }
+    pool_destroy(&pool);
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,229 @@
+#define _GNU_SOURCE             /* gettid */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "trace.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define read_ticks() __rdtsc()
+#else
+static inline uint64_t
+read_ticks(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+#endif
+
+_Static_assert((TRACE_RING_EVENTS & (TRACE_RING_EVENTS - 1)) == 0,
+               "TRACE_RING_EVENTS must be a power of two");
+
+struct trace_record {
+    uint64_t ticks;
+    const char *name;
+    int64_t value;
+    char phase;
+};
+
+/* One per thread. Only the owning thread writes events and head; the
+    exporter reads head with acquire ordering, so every event below it
+    is complete. */
+
+struct trace_buffer {
+    struct trace_buffer *next;      /* list of every thread's buffer */
+    pid_t tid;
+    const char *thread_name;
+    uint64_t exported;              /* events before this were exported */
+    _Atomic uint64_t head;          /* events recorded so far */
+    struct trace_record records[TRACE_RING_EVENTS];
+};
+
+static _Thread_local struct trace_buffer *my_buffer;
+static _Atomic(struct trace_buffer *) buffers;
+
+/* Ticks are converted to CLOCK_MONOTONIC microseconds at export, from
+    a pair of readings taken at start-up and another taken then. Every
+    process uses the same clock, so forked processes line up. */
+
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static uint64_t start_ticks;
+static double start_us;
+
+static double
+monotonic_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* A forked child has only the forking thread, and its events so far
+    belong to the parent, which exports them itself. */
+
+static void
+after_fork_in_child(void)
+{
+    atomic_store(&buffers, my_buffer);
+    if (my_buffer != NULL) {
+        my_buffer->next = NULL;
+        my_buffer->tid = gettid();
+        my_buffer->exported = atomic_load(&my_buffer->head);
+    }
+}
+
+static void
+init(void)
+{
+    start_us = monotonic_us();
+    start_ticks = read_ticks();
+    pthread_atfork(NULL, NULL, after_fork_in_child);
+}
+
+static struct trace_buffer *
+new_buffer(void)
+{
+    struct trace_buffer *b;
+
+    pthread_once(&once, init);
+    b = calloc(1, sizeof(*b));
+    if (b == NULL)
+        return NULL;
+    b->tid = gettid();
+    b->next = atomic_load(&buffers);
+    while (!atomic_compare_exchange_weak(&buffers, &b->next, b))
+        continue;
+    return my_buffer = b;
+}
+
+void
+trace_event(const char *name, char phase, int64_t value)
+{
+    struct trace_buffer *b = my_buffer;
+    struct trace_record *r;
+    uint64_t head;
+
+    if (b == NULL && (b = new_buffer()) == NULL)
+        return;
+    head = atomic_load_explicit(&b->head, memory_order_relaxed);
+    r = &b->records[head & (TRACE_RING_EVENTS - 1)];
+    r->ticks = read_ticks();
+    r->name = name;
+    r->value = value;
+    r->phase = phase;
+    atomic_store_explicit(&b->head, head + 1, memory_order_release);
+}
+
+void
+trace_thread_name(const char *name)
+{
+    struct trace_buffer *b = my_buffer;
+
+    if (b == NULL && (b = new_buffer()) == NULL)
+        return;
+    b->thread_name = name;
+}
+
+/* Write s as a quoted JSON string. Names are usually plain literals,
+    but one with a quote or backslash must not break the trace file. */
+
+static void
+put_json_string(FILE *out, const char *s)
+{
+    putc('"', out);
+    for (; *s; s++) {
+        unsigned char c = *s;
+
+        if (c == '"' || c == '\\')
+            fprintf(out, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(out, "\\u%04x", c);
+        else
+            putc(c, out);
+    }
+    putc('"', out);
+}
+
+int
+trace_export(const char *path)
+{
+    char *buf = NULL;
+    size_t size = 0;
+    double us_per_tick;
+    struct stat sb;
+    pid_t pid = getpid();
+    FILE *out;
+    int fd, rc = 0;
+
+    if (path == NULL && (path = getenv("TRACE_FILE")) == NULL)
+        path = "trace.json";
+    pthread_once(&once, init);
+    us_per_tick = (monotonic_us() - start_us) / (double) (read_ticks() - start_ticks);
+
+    /* Format everything in memory, then append it with one write(), so
+        processes exporting to the same file at once do not interleave. */
+
+    out = open_memstream(&buf, &size);
+    if (out == NULL)
+        return -1;
+    for (struct trace_buffer *b = atomic_load(&buffers); b != NULL; b = b->next) {
+        uint64_t head = atomic_load_explicit(&b->head, memory_order_acquire);
+        uint64_t first = b->exported;
+
+        if (head - first > TRACE_RING_EVENTS)
+            first = head - TRACE_RING_EVENTS;       /* overwritten */
+        if (b->thread_name != NULL) {
+            fprintf(out, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, "
+                    "\"tid\": %d, \"args\": {\"name\": ", pid, b->tid);
+            put_json_string(out, b->thread_name);
+            fprintf(out, "}},\n");
+        }
+        for (uint64_t i = first; i < head; i++) {
+            const struct trace_record *r = &b->records[i & (TRACE_RING_EVENTS - 1)];
+            double ts = start_us + (double) (r->ticks - start_ticks) * us_per_tick;
+
+            fprintf(out, "{\"name\": ");
+            put_json_string(out, r->name);
+            fprintf(out, ", \"ph\": \"%c\", \"ts\": %.3f, \"pid\": %d, \"tid\": %d",
+                    r->phase, ts, pid, b->tid);
+            if (r->phase == 'C')
+                fprintf(out, ", \"args\": {\"value\": %lld}", (long long) r->value);
+            else if (r->phase == 'i')
+                fprintf(out, ", \"s\": \"t\"");
+            fprintf(out, "},\n");
+        }
+        b->exported = head;
+    }
+    if (fclose(out) == EOF) {
+        free(buf);
+        return -1;
+    }
+
+    /* The array format lets the closing ']' be left off, which is what
+        makes appending work. The first writer opens the array; the lock
+        keeps two processes from both finding the file empty. */
+
+    fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd == -1 || flock(fd, LOCK_EX) == -1 || fstat(fd, &sb) == -1 ||
+            (sb.st_size == 0 && write(fd, "[\n", 2) != 2) ||
+            write(fd, buf, size) != (ssize_t) size)
+        rc = -1;
+    if (fd != -1) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+    }
+    free(buf);
+    return rc;
+}
@@ -0,0 +1,58 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+/* Low-overhead event tracing, exported as Chrome/Perfetto trace JSON.
+
+    Trace points are macros that compile to nothing unless the program
+    is built with -DTRACE_ENABLED (and linked with trace.c), so they can
+    stay in hot paths for good. When enabled, each thread appends fixed-
+    size events to its own ring buffer, stamped with the CPU's time-stamp
+    counter: no locks, no syscalls and no allocation after the thread's
+    first event. When a ring fills, the oldest events are overwritten.
+
+    TRACE_EXPORT() writes every thread's buffered events to the file
+    named by $TRACE_FILE (default "trace.json") in the JSON array format,
+    appending, so processes that fork (like the echo server) can all
+    write to one file and be viewed on one timeline: open it in
+    chrome://tracing or ui.perfetto.dev. Export once the traced threads
+    are quiet; events recorded during an export may be missing. */
+
+#ifndef TRACE_RING_EVENTS
+#define TRACE_RING_EVENTS (64 * 1024)   /* per thread, power of two */
+#endif
+
+#ifdef TRACE_ENABLED
+
+#define TRACE_BEGIN(name)           trace_event((name), 'B', 0)
+#define TRACE_END(name)             trace_event((name), 'E', 0)
+#define TRACE_INSTANT(name)         trace_event((name), 'i', 0)
+#define TRACE_COUNTER(name, value)  trace_event((name), 'C', (value))
+#define TRACE_THREAD_NAME(name)     trace_thread_name(name)
+#define TRACE_EXPORT()              trace_export(NULL)
+
+#else
+
+#define TRACE_BEGIN(name)           ((void) 0)
+#define TRACE_END(name)             ((void) 0)
+#define TRACE_INSTANT(name)         ((void) 0)
+#define TRACE_COUNTER(name, value)  ((void) 0)
+#define TRACE_THREAD_NAME(name)     ((void) 0)
+#define TRACE_EXPORT()              ((void) 0)
+
+#endif
+
+/* Record one event on the calling thread. name must be a string that
+    outlives the export (in practice, a literal). phase is the Chrome
+    event type: 'B'egin, 'E'nd, 'i'nstant or 'C'ounter. */
+void trace_event(const char *name, char phase, int64_t value);
+
+/* Name the calling thread in the exported timeline. */
+void trace_thread_name(const char *name);
+
+/* Append all buffered events to path (NULL: $TRACE_FILE or
+    "trace.json"). Returns 0, or -1 with errno set. */
+int trace_export(const char *path);
+
+#endif